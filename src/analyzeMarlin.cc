@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <random>
 
 #include <marlinlib/marlin.hpp>
 
@@ -899,6 +900,82 @@ int main() {
 			)ML";
 	}
 	
+	// Context switched dictionaries vs single dictionary, on a source alternating between flat and busy regions.
+	if (false) {
+
+		tex << "\\input{results/context1.tex}\n";
+		ofstream res("results/context1.tex");
+
+		res << R"ML(
+		\begin{figure}
+		\centering
+		\begin{tikzpicture} 
+		\begin{axis}[
+			title="Context Switched Dictionaries", 
+			title style={yshift=-1mm},
+			height=3cm, width=6cm,
+			scale only axis, 
+			enlargelimits=false, 
+			xmin=1, xmax=16, 
+			ymajorgrids, major grid style={dotted, gray}, 
+			x tick label style={font={\footnotesize},yshift=1mm}, 
+			y tick label style={font={\footnotesize},xshift=-1mm},
+			ylabel={\emph{Bits per symbol}}, 
+			xlabel={\emph{Busy region scale}}, 
+			xlabel style={font={\footnotesize},xshift= 2mm}, 
+			ylabel style={font={\footnotesize},yshift=-2mm},
+			legend style={at={(0.5,-0.2)},legend columns=-1,anchor=north,nodes={scale=0.75, transform shape}}
+			])ML";
+
+		Marlin2018Simple::clearConfiguration();
+
+		std::string simplePlot, contextPlot, entropyPlot;
+		for (size_t scale=1; scale<=16; scale++) {
+			
+			std::mt19937 rng(1);
+			std::vector<uint8_t> data(1<<20);
+			bool busy = false;
+			for (auto &&d : data) {
+				if (rng()%300==0) busy = not busy;
+				std::exponential_distribution<double> e(busy ? 1./scale : 2.5);
+				int v = std::min(127, int(e(rng)+0.5));
+				d = uint8_t(int8_t(rng()&1 ? v : -v));
+			}
+			
+			std::vector<double> pdf(256, 1e-3);
+			for (auto &&d : data) pdf[d]++;
+			for (auto &&p : pdf) p /= data.size();
+			
+			auto contextOf = Marlin2018Context::magnitudeContexts(4);
+			Marlin2018Simple simple(pdf, 12, 0, 7);
+			Marlin2018Context context(Marlin2018Context::conditionalPdfs(data, contextOf, 4), 12, 6, contextOf);
+			
+			size_t simpleBytes = 0, contextBytes = 0, blockSize = 4096;
+			for (size_t i=0; i<data.size(); i+=blockSize) {
+				std::vector<uint8_t> in(data.begin()+i, data.begin()+i+blockSize), out(2*blockSize);
+				simple.encode(in, out); simpleBytes += out.size();
+				out.resize(2*blockSize);
+				context.encode(in, out); contextBytes += out.size();
+			}
+			
+			simplePlot  += "(" + std::to_string(scale) + "," + std::to_string(8.*simpleBytes/data.size()) + ")";
+			contextPlot += "(" + std::to_string(scale) + "," + std::to_string(8.*contextBytes/data.size()) + ")";
+			entropyPlot += "(" + std::to_string(scale) + "," + std::to_string(Distribution::entropy(pdf)) + ")";
+		}
+		res << "\\addplot+[line width=2pt, gray!50, mark=none] coordinates { " << entropyPlot << "};" << std::endl;
+		res << "\\addplot+[line width=1pt,mark=none] coordinates { " << simplePlot << "};" << std::endl;
+		res << "\\addplot+[line width=1pt,mark=none] coordinates { " << contextPlot << "};" << std::endl;
+
+		res << R"ML(
+			\legend{Entropy, Single, Context}
+			\end{axis} 
+			\end{tikzpicture}
+			\caption{}
+			\label{fig:}
+			\end{figure}
+			)ML";
+	}
+	
 	tex << "\\end{document}" << endl;
 	
 	return 0;
@@ -7,12 +7,14 @@
 #include <queue>
 #include <chrono>
 #include <memory>
+#include <atomic>
 #include <iostream>
 
 #include <opencv/cv.h>
 #include <opencv/highgui.h>
 
 #include <util/distribution.hpp>
+#include <util/engine.hpp>
 
 
 #include <codecs/rle.hpp>
@@ -30,6 +32,10 @@
 #include <codecs/marlin.hpp>
 #include <codecs/marlin2018.hpp>
 #include <codecs/marlin2019.hpp>
+#include <codecs/hybrid.hpp>
+#include <codecs/for.hpp>
+#include <codecs/marlinlz.hpp>
+#include <codecs/rans.hpp>
 
 #include <uSnippets/log.hpp>
 //#include <uSnippets/mpng.hpp>
@@ -660,7 +666,7 @@ namespace compressors {
 			cv::Mat1b predicted = predictors::Planar2Predicted(img1b.clone(), predictors::PREDICTOR_ABC);
 			cv::Mat1b stripped = compressors::Predicted2Stripped(predicted, 32);
 
-			UncompressedData8 in(stripped.data, stripped.rows*stripped.cols);
+			auto in = UncompressedData8::view(stripped.data, stripped.rows*stripped.cols);
 			CompressedData8 compressed;
 			
 			if (singleThreaded) {
@@ -881,16 +887,23 @@ static std::vector<std::shared_ptr<compressors::ICodec>> getCodecs() {
 	return std::vector<std::shared_ptr<compressors::ICodec>>{
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<Lz4>()),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<Rice>()),
+		std::make_shared<compressors::EntropyCodec>(std::make_shared<Rice>(Distribution::Laplace, true)),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<RLE>()),
 //		std::make_shared<compressors::EntropyCodec>(std::make_shared<Snappy>()),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<Nibble>()),
+		std::make_shared<compressors::EntropyCodec>(std::make_shared<FOR>()),
+		std::make_shared<compressors::EntropyCodec>(std::make_shared<Rans>()),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<FiniteStateEntropy>(), false),
+		std::make_shared<compressors::EntropyCodec>(std::make_shared<FiniteStateEntropyStatic>()),
 //		std::make_shared<compressors::EntropyCodec>(std::make_shared<Gipfeli>()),
 //			std::make_shared<compressors::EntropyCodec>(std::make_shared<Gzip>()),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<Lzo>()),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<Huff0>()),
+		std::make_shared<compressors::EntropyCodec>(std::make_shared<Huff0Static>(Distribution::Laplace, true)),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<Zstd>()),
 		std::make_shared<compressors::EntropyCodec>(std::make_shared<Marlin2019>(Distribution::Laplace,baseConf)),
+		std::make_shared<compressors::EntropyCodec>(std::make_shared<Hybrid>()),
+		std::make_shared<compressors::EntropyCodec>(std::make_shared<MarlinLZ>()),
 //		std::make_shared<compressors::EntropyCodec>(std::make_shared<CharLS>()),
 		
 //		std::make_shared<compressors::OpenCVCodec>(".jp2",std::vector<int>{}),
@@ -1197,14 +1210,11 @@ int main(int argc, char **argv) {
 				//uSnippets::Log(0) << (double(originalSize)/compressedSize);
 			}
 				
-			std::mutex mtx;
-			typedef std::lock_guard<std::mutex> Lock;
-
-			std::deque< std::shared_ptr<Msg>> processingQueue;
-			
-			size_t imagesDone = 0;
+			std::atomic<size_t> imagesDone(0);
 			bool done = false;
 			
+			CodecEngine engine(nCores, 100);
+			
 			std::thread producer([&](){
 
 				auto ip = compressedMessages.begin();
@@ -1213,12 +1223,10 @@ int main(int argc, char **argv) {
 					if (ip==compressedMessages.end()) ip = compressedMessages.begin();
 					auto msgptr = *ip++;
 					
-
-					{
-						Lock l(mtx);
-						if (processingQueue.size()<100)
-							processingQueue.push_back(msgptr);
-					}
+					engine.tryPost(codec.get(), [&imagesDone, codec, msgptr](){
+						codec->decode( msgptr->first, msgptr->second );
+						imagesDone++;
+					});
 					
 					double bandwidthTime = msgptr->first.size()/testType.bandwidth;
 					
@@ -1230,37 +1238,13 @@ int main(int argc, char **argv) {
 				};
 			});
 
-			std::vector<std::thread> consumers;
-			for (int i=0; i<nCores; i++) consumers.emplace_back([&](){
-				
-				while (!done) {
-					
-					std::shared_ptr<Msg> msgptr;
-					{
-						Lock l(mtx);
-						if (not processingQueue.empty()) {
-							msgptr = processingQueue.front();
-							processingQueue.pop_front();
-						}
-					}
-					if (not msgptr) {
-						std::this_thread::sleep_for(std::chrono::nanoseconds(100));
-						continue;
-					}
-					
-					codec->decode( msgptr->first, msgptr->second );
-					imagesDone++;
-					std::this_thread::yield();
-				};	
-			});
-			
 			std::this_thread::sleep_for(std::chrono::milliseconds(1000));
 			done = true;
+			size_t imagesDoneInTime = imagesDone;
 			producer.join();
-			for (auto &&t : consumers) t.join();
 			
 			
-			uSnippets::Log(1) << codec->name() << ": " << imagesDone << " Images/second" << " " << (double(originalSize)/compressedSize) << " Compression Ratio";
+			uSnippets::Log(1) << codec->name() << ": " << imagesDoneInTime << " Images/second" << " " << (double(originalSize)/compressedSize) << " Compression Ratio";
 			
 		}
 		}
@@ -0,0 +1,183 @@
+#include <codecs/for.hpp>
+#include <cstring>
+#include <string>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// A packet is the reference byte, the bit width W, and groups of 256 offsets packed in 32*W bytes. Within a group,
+// offsets are 8 rows of 32; lane j of the W packed rows holds the 8 offsets of lane j back to back, so that all 
+// lanes are packed and unpacked at once with byte shifts. The last group is padded with the reference.
+struct FORPimpl : public CODEC8Zstatic<FORPimpl> {
+
+	static const size_t Lanes = 32, GroupSize = 8*Lanes;
+
+	std::string name() const { return "FOR"; }
+
+#ifdef __AVX2__
+	// Byte wise shifts, from 16 bit shifts masking the bits that cross between bytes.
+	template<int S> static __m256i sll8(__m256i x) { return _mm256_and_si256(_mm256_slli_epi16(x, S), _mm256_set1_epi8(uint8_t(0xFF<<S))); }
+	template<int S> static __m256i srl8(__m256i x) { return _mm256_and_si256(_mm256_srli_epi16(x, S), _mm256_set1_epi8(uint8_t(0xFF>>S))); }
+
+	template<int W, int K> struct Row {
+
+		static const int bit = K*W, m = bit/8, s = bit%8;
+		static const bool split = s+W>8;
+
+		static void pack(const __m256i *v, __m256i *o) {
+
+			o[m] = _mm256_or_si256(o[m], sll8<s>(v[K]));
+			if (split) o[m+1] = _mm256_or_si256(o[m+1], srl8<(8-s)%8>(v[K]));
+			Row<W,K+1>::pack(v, o);
+		}
+
+		static void unpack(const uint8_t *in, __m256i ref, uint8_t *out) {
+
+			__m256i x = srl8<s>(_mm256_loadu_si256((const __m256i *)(in + m*Lanes)));
+			if (split) x = _mm256_or_si256(x, sll8<(8-s)%8>(_mm256_loadu_si256((const __m256i *)(in + (m+1)*Lanes))));
+			x = _mm256_and_si256(x, _mm256_set1_epi8((1<<W)-1));
+			_mm256_storeu_si256((__m256i *)(out + K*Lanes), _mm256_add_epi8(x, ref));
+			Row<W,K+1>::unpack(in, ref, out);
+		}
+	};
+
+	template<int W> struct Row<W,8> {
+		static void pack(const __m256i *, __m256i *) {}
+		static void unpack(const uint8_t *, __m256i, uint8_t *) {}
+	};
+
+	template<int W> static void pack(const uint8_t *in, uint8_t ref, uint8_t *out) {
+
+		__m256i v[8], o[W];
+		for (int k=0; k<8; k++) v[k] = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i *)(in + k*Lanes)), _mm256_set1_epi8(ref));
+		for (int m=0; m<W; m++) o[m] = _mm256_setzero_si256();
+		Row<W,0>::pack(v, o);
+		for (int m=0; m<W; m++) _mm256_storeu_si256((__m256i *)(out + m*Lanes), o[m]);
+	}
+
+	template<int W> static void unpack(const uint8_t *in, uint8_t ref, uint8_t *out) {
+
+		Row<W,0>::unpack(in, _mm256_set1_epi8(ref), out);
+	}
+#else
+	template<int W> static void pack(const uint8_t *in, uint8_t ref, uint8_t *out) {
+
+		memset(out, 0, W*Lanes);
+		for (int k=0; k<8; k++) {
+			int bit = k*W, m = bit/8, s = bit%8;
+			for (size_t j=0; j<Lanes; j++) {
+				uint8_t v = in[k*Lanes+j] - ref;
+				out[m*Lanes+j] |= v<<s;
+				if (s+W>8) out[(m+1)*Lanes+j] |= v>>(8-s);
+			}
+		}
+	}
+
+	template<int W> static void unpack(const uint8_t *in, uint8_t ref, uint8_t *out) {
+
+		for (int k=0; k<8; k++) {
+			int bit = k*W, m = bit/8, s = bit%8;
+			for (size_t j=0; j<Lanes; j++) {
+				uint8_t v = in[m*Lanes+j]>>s;
+				if (s+W>8) v |= in[(m+1)*Lanes+j]<<(8-s);
+				out[k*Lanes+j] = (v & ((1<<W)-1)) + ref;
+			}
+		}
+	}
+#endif
+
+	typedef void (*Kernel)(const uint8_t *, uint8_t, uint8_t *);
+	static const Kernel packers[8], unpackers[8];
+
+	static int width(uint8_t range) { return range ? 32-__builtin_clz(range) : 0; }
+
+	// Takes the reference that gives the narrower range, reading the block as unsigned or as signed bytes.
+	static void frame(const uint8_t *in, size_t n, uint8_t &ref, int &w) {
+
+		uint8_t umin = 255, umax = 0;
+		int8_t  smin = 127, smax = -128;
+		for (size_t j=0; j<n; j++) {
+			umin = std::min(umin, in[j]);
+			umax = std::max(umax, in[j]);
+			smin = std::min(smin, int8_t(in[j]));
+			smax = std::max(smax, int8_t(in[j]));
+		}
+		if (umax-umin <= smax-smin) {
+			ref = umin;
+			w = width(umax-umin);
+		} else {
+			ref = smin;
+			w = width(smax-smin);
+		}
+	}
+
+	// The entropy byte is not used, so the histogram pass of CODEC8Z is replaced by the frame: blocks that need 
+	// all 8 bits are stored raw, the rest go to compressPacket with a dummy entropy byte.
+	uint8_t classify(const uint8_t *in, size_t n, uint8_t &shift) const {
+
+		shift = 0;
+
+		// Skip compression of very small blocks
+		if (n<256) return 255;
+
+		bool zero = true;
+		for (size_t j=1; j<n; j++) 
+			zero &= (in[j] == 0);
+		if (zero) return 0;
+
+		uint8_t ref; int w;
+		frame(in, n, ref, w);
+		return w<8 ? 1 : 255;
+	}
+
+	size_t compressPacket(const uint8_t *in, size_t n, uint8_t *out, uint8_t &entropy __attribute__((unused))) const {
+
+		uint8_t ref; int w;
+		frame(in, n, ref, w);
+
+		size_t nGroups = (n+GroupSize-1)/GroupSize;
+		size_t sz = 2 + nGroups*Lanes*w;
+		if (sz >= n) return n;
+
+		out[0] = ref;
+		out[1] = w;
+		if (w == 0) return sz;
+
+		uint8_t *o = out+2;
+		size_t j = 0;
+		for (; j+GroupSize<=n; j+=GroupSize, o+=Lanes*w)
+			packers[w](in+j, ref, o);
+		if (j<n) {
+			uint8_t last[GroupSize];
+			memset(last, ref, GroupSize);
+			memcpy(last, in+j, n-j);
+			packers[w](last, ref, o);
+		}
+		return sz;
+	}
+
+	void uncompressPacket(const uint8_t *in, size_t n __attribute__((unused)), uint8_t *out, size_t outSize, uint8_t entropy __attribute__((unused))) const {
+
+		uint8_t ref = in[0]; int w = in[1];
+		if (w == 0) {
+			memset(out, ref, outSize);
+			return;
+		}
+
+		const uint8_t *i = in+2;
+		size_t j = 0;
+		for (; j+GroupSize<=outSize; j+=GroupSize, i+=Lanes*w)
+			unpackers[w](i, ref, out+j);
+		if (j<outSize) {
+			uint8_t last[GroupSize];
+			unpackers[w](i, ref, last);
+			memcpy(out+j, last, outSize-j);
+		}
+	}
+};
+
+const FORPimpl::Kernel FORPimpl::packers[8]   = { nullptr, pack<1>, pack<2>, pack<3>, pack<4>, pack<5>, pack<6>, pack<7> };
+const FORPimpl::Kernel FORPimpl::unpackers[8] = { nullptr, unpack<1>, unpack<2>, unpack<3>, unpack<4>, unpack<5>, unpack<6>, unpack<7> };
+
+FOR::FOR() : CODEC8withPimpl(new FORPimpl()) {}
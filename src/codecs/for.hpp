@@ -0,0 +1,5 @@
+#pragma once
+#include <util/codec.hpp>
+
+// Frame of reference: each block is stored as its minimum and the offsets to it, bit packed at the width of its range.
+struct FOR : public CODEC8withPimpl { FOR(); };
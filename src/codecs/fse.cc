@@ -1,6 +1,13 @@
 #include <codecs/fse.hpp>
 #include <FiniteStateEntropy/lib/fse.h>
 
+#include <vector>
+#include <array>
+#include <string>
+#include <memory>
+#include <cmath>
+#include <stdexcept>
+
 class FiniteStateEntropyPimpl : public CODEC8AA {
 	
 	std::string name() const { return "FSE"; }
@@ -30,4 +37,58 @@ class FiniteStateEntropyPimpl : public CODEC8AA {
 	}
 };
 
+class FiniteStateEntropyStaticPimpl : public CODEC8Zstatic<FiniteStateEntropyStaticPimpl> {
+
+	static const size_t SPLITS = 64;
+	static const unsigned TableLog = 12;
+
+	std::vector<std::shared_ptr<FSE_CTable>> ctables;
+	std::vector<std::shared_ptr<FSE_DTable>> dtables;
+
+public:
+	std::string name() const { return "FSEStatic"; }
+
+	FiniteStateEntropyStaticPimpl(Distribution::Type distType) {
+
+		enableModeShift = true;
+
+		for (size_t split=0; split<SPLITS; split++) {
+
+			auto pdf = Distribution::pdf(distType, (split+0.5)/SPLITS);
+			std::array<unsigned,256> count;
+			size_t total = 0;
+			for (size_t s=0; s<256; s++)
+				total += count[s] = std::max(1., std::round(pdf[s]*(1<<16)));
+
+			short norm[256];
+			if (FSE_isError(FSE_normalizeCount(norm, TableLog, count.data(), total, 255)))
+				throw std::runtime_error("FSEStatic: could not normalize counts");
+
+			ctables.emplace_back(FSE_createCTable(255, TableLog), FSE_freeCTable);
+			dtables.emplace_back(FSE_createDTable(TableLog), FSE_freeDTable);
+			if (FSE_isError(FSE_buildCTable(ctables.back().get(), norm, 255, TableLog)) or
+			    FSE_isError(FSE_buildDTable(dtables.back().get(), norm, 255, TableLog)))
+				throw std::runtime_error("FSEStatic: could not build table");
+		}
+	}
+
+	size_t compressPacket(const uint8_t *in, size_t n, uint8_t *out, uint8_t &entropy) const {
+
+		size_t ret = FSE_compress_usingCTable(out, n, in, n, ctables[entropy*SPLITS/256].get());
+
+		// FSE returns 0 when the output does not fit.
+		return (ret==0 or FSE_isError(ret)) ? n : ret;
+	}
+
+	void uncompressPacket(const uint8_t *in, size_t n, uint8_t *out, size_t outSize, uint8_t entropy) const {
+
+		size_t ret = FSE_decompress_usingDTable(out, outSize, in, n, dtables[entropy*SPLITS/256].get());
+		if (FSE_isError(ret) or ret != outSize)
+			throw std::runtime_error("FSEStatic: corrupted block");
+	}
+};
+
 FiniteStateEntropy::FiniteStateEntropy() : CODEC8withPimpl(new FiniteStateEntropyPimpl()) {}
+
+FiniteStateEntropyStatic::FiniteStateEntropyStatic(Distribution::Type distType) 
+	: CODEC8withPimpl(new FiniteStateEntropyStaticPimpl(distType)) {}
@@ -1,4 +1,8 @@
 #pragma once
 #include <util/codec.hpp>
+#include <util/distribution.hpp>
 
 struct FiniteStateEntropy : public CODEC8withPimpl { FiniteStateEntropy(); };
+
+// FSE coding with prebuilt tables selected by the entropy byte of each block, so blocks carry no table.
+struct FiniteStateEntropyStatic : public CODEC8withPimpl { FiniteStateEntropyStatic(Distribution::Type distType = Distribution::Laplace); };
@@ -1,6 +1,13 @@
 #include <codecs/huf.hpp>
+#define HUF_STATIC_LINKING_ONLY
 #include <FiniteStateEntropy/lib/huf.h>
 
+#include <vector>
+#include <array>
+#include <string>
+#include <cmath>
+#include <stdexcept>
+
 class Huff0Pimpl : public CODEC8AA {
 	
 	std::string name() const { return "Huff0"; };
@@ -30,5 +37,75 @@ class Huff0Pimpl : public CODEC8AA {
 	}
 };
 
+class Huff0StaticPimpl : public CODEC8Zstatic<Huff0StaticPimpl> {
+
+	static const size_t SPLITS = 64;
+	static const unsigned MaxCodeLength = 11;
+
+	// HUF_CElt is opaque, so the coding table lives in raw storage, as HUF_CREATE_STATIC_CTABLE does it.
+	struct Tables {
+		uint32_t ctableStorage[HUF_CTABLE_SIZE_U32(255)];
+		HUF_CREATE_STATIC_DTABLEX2(dtable, HUF_TABLELOG_MAX);
+
+		      HUF_CElt *ctable()       { void *p = ctableStorage; return static_cast<HUF_CElt *>(p); }
+		const HUF_CElt *ctable() const { const void *p = ctableStorage; return static_cast<const HUF_CElt *>(p); }
+	};
+	std::vector<Tables> tables;
+
+	bool fourStreams;
+
+public:
+	std::string name() const { return fourStreams ? "Huff0Static4X" : "Huff0Static"; }
+
+	Huff0StaticPimpl(Distribution::Type distType, bool fourStreams_) : tables(SPLITS), fourStreams(fourStreams_) {
+
+		enableModeShift = true;
+
+		for (size_t split=0; split<SPLITS; split++) {
+
+			auto pdf = Distribution::pdf(distType, (split+0.5)/SPLITS);
+			std::array<unsigned,256> count;
+			for (size_t s=0; s<256; s++)
+				count[s] = std::max(1., std::round(pdf[s]*(1<<16)));
+
+			HUF_CElt *ct = tables[split].ctable();
+			size_t maxNbBits = HUF_buildCTable(ct, count.data(), 255, MaxCodeLength);
+			if (HUF_isError(maxNbBits))
+				throw std::runtime_error("Huff0Static: could not build table");
+
+			// The decoding table is built from the serialized coding table, so both sides agree on the codes.
+			uint8_t header[512];
+			size_t headerSize = HUF_writeCTable(header, sizeof(header), ct, 255, maxNbBits);
+			if (HUF_isError(headerSize) or HUF_isError(HUF_readDTableX2(tables[split].dtable, header, headerSize)))
+				throw std::runtime_error("Huff0Static: could not build table");
+		}
+	}
+
+	size_t compressPacket(const uint8_t *in, size_t n, uint8_t *out, uint8_t &entropy) const {
+
+		const HUF_CElt *ct = tables[entropy*SPLITS/256].ctable();
+		size_t ret = fourStreams ? 
+			HUF_compress4X_usingCTable(out, n, in, n, ct) :
+			HUF_compress1X_usingCTable(out, n, in, n, ct);
+
+		// Huff0 returns 0 when the output does not fit.
+		return (ret==0 or HUF_isError(ret)) ? n : ret;
+	}
+
+	void uncompressPacket(const uint8_t *in, size_t n, uint8_t *out, size_t outSize, uint8_t entropy) const {
+
+		const HUF_DTable *dt = tables[entropy*SPLITS/256].dtable;
+		size_t ret = fourStreams ?
+			HUF_decompress4X_usingDTable(out, outSize, in, n, dt) :
+			HUF_decompress1X_usingDTable(out, outSize, in, n, dt);
+
+		if (HUF_isError(ret) or ret != outSize)
+			throw std::runtime_error("Huff0Static: corrupted block");
+	}
+};
+
 Huff0::Huff0() : CODEC8withPimpl(new Huff0Pimpl()) {}
 
+Huff0Static::Huff0Static(Distribution::Type distType, bool fourStreams) 
+	: CODEC8withPimpl(new Huff0StaticPimpl(distType, fourStreams)) {}
+
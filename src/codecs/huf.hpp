@@ -1,4 +1,9 @@
 #pragma once
 #include <util/codec.hpp>
+#include <util/distribution.hpp>
 
 struct Huff0 : public CODEC8withPimpl { Huff0(); };
+
+// Huff0 coding with prebuilt tables: the entropy byte of each block selects one of a set of Huffman tables, 
+// as in Rice and Marlin, so blocks carry no table. fourStreams uses Huff0's 4 stream format.
+struct Huff0Static : public CODEC8withPimpl { Huff0Static(Distribution::Type distType = Distribution::Laplace, bool fourStreams = false); };
@@ -0,0 +1,257 @@
+#include <codecs/hybrid.hpp>
+#include <codecs/marlin2018.hpp>
+#include <codecs/rice.hpp>
+#include <codecs/rle.hpp>
+#include <codecs/nibble.hpp>
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <cmath>
+#include <cstring>
+#include <sstream>
+
+struct HybridPimpl : public CODEC8 {
+
+	// Codec id of each block, stored in the header. Marlin blocks are coded together by its CODEC8Z path, whose 
+	// header follows them; blocks of other codecs are framed by their compressBlock.
+	enum { RAW = 0, MARLIN, RICE, RLE_, NIBBLE, NUM_CODECS };
+	std::array<std::shared_ptr<CODEC8>, NUM_CODECS> codecs;
+
+	// Marlin dictionaries are trained for a family of distributions indexed by entropy; its cost is estimated 
+	// with the cross entropy against the closest one. Measured overheads over that estimate, in bytes.
+	static const int LEVELS = 64;
+	std::array<std::array<float,256>,LEVELS> marlinCost;
+	constexpr static const double marlinEfficiency = 0.94;
+	static const size_t marlinOverhead = 24, riceOverhead = 8, frameOverhead = 4;
+	static const size_t marlinHeader = 2; // entropy and shift bytes of a CODEC8Z block
+
+	// Marlin decodes several times faster than Rice, so other codecs must beat its estimate by this fraction.
+	double marlinPreference;
+
+	std::string coderName;
+	std::string name() const { return coderName; }
+
+	HybridPimpl(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict, double marlinPreference_) : marlinPreference(marlinPreference_) {
+
+		codecs[MARLIN] = std::make_shared<Marlin2018>(distType, keySize, overlap, numDict, false, true); // The estimate assumes the mode shift
+		codecs[RICE]   = std::make_shared<Rice>(distType);
+		codecs[RLE_]   = std::make_shared<RLE>();
+		codecs[NIBBLE] = std::make_shared<Nibble>();
+
+		std::ostringstream oss;
+		oss << "Hybrid " << codecs[MARLIN]->name().substr(11);
+		coderName = oss.str();
+
+		for (size_t l=0; l<LEVELS; l++) {
+			auto pdf = Distribution::pdf(distType, (l+0.5)/LEVELS);
+			for (size_t s=0; s<256; s++)
+				marlinCost[l][s] = std::min(-std::log2(pdf[s]), 2.*keySize)/(8*marlinEfficiency);
+		}
+	}
+
+	// Blocks other than Marlin ones go through the single block API of the candidates.
+	void setBlockSizeBytes(size_t n) {
+
+		if (n>size_t(BlockSizeBytes)) throw std::runtime_error("Hybrid blocks are limited to BlockSizeBytes");
+		CODEC8::setBlockSizeBytes(n);
+		codecs[MARLIN]->setBlockSizeBytes(n);
+	}
+
+	// Estimated size in bytes of the block coded with each codec.
+	void estimate(const uint8_t *in, size_t n, std::array<double, NUM_CODECS> &cost) const {
+
+		std::array<uint32_t,256> hist; hist.fill(0);
+		size_t zeroRuns = 0;
+		uint8_t last = 1;
+		for (size_t j=0; j<n; j++) {
+			hist[in[j]]++;
+			zeroRuns += (last and not in[j]);
+			last = in[j];
+		}
+
+		cost[RAW] = n;
+
+		// Marlin, also with the mode shift of CODEC8Z, which stores blocks of zeros but the first as one byte.
+		if (n>=256 and hist[0] + (in[0]!=0) == n) {
+			cost[MARLIN] = 1 + marlinHeader;
+		} else {
+			double entropy = 0;
+			for (auto &&h : hist)
+				if (h) entropy -= h*std::log2(double(h)/n);
+			size_t level = std::min(LEVELS-1, int(entropy/(8*n)*LEVELS));
+
+			size_t mode = std::max_element(hist.begin(), hist.end()) - hist.begin();
+			double c0 = 0, cMode = 0;
+			for (size_t s=0; s<256; s++) {
+				c0    += hist[s]*marlinCost[level][s];
+				cMode += hist[s]*marlinCost[level][uint8_t(s-mode)];
+			}
+			cost[MARLIN] = std::min(c0, cMode) + marlinOverhead + marlinHeader;
+		}
+
+		// Rice, with symbols ranked by magnitude and the best parameter.
+		{
+			std::array<double,8> bits; bits.fill(0);
+			for (size_t s=0; s<256; s++) {
+				if (not hist[s]) continue;
+				int v = int8_t(s);
+				uint32_t rank = v<0 ? -2*v-1 : 2*v;
+				for (size_t m=0; m<8; m++)
+					bits[m] += hist[s]*(1+m+(rank>>m));
+			}
+			cost[RICE] = *std::min_element(bits.begin(), bits.end())/8 + riceOverhead;
+		}
+
+		// RLE emits every non zero symbol, and each zero followed by the length of its run.
+		cost[RLE_] = n - hist[0] + 2*zeroRuns + hist[0]/255.;
+
+		// Nibble packs two symbols in [-7,7] per byte, and spends one more byte for each symbol out of it.
+		if (n%16) {
+			cost[NIBBLE] = 2*n;
+		} else {
+			size_t escapes = 0;
+			for (size_t s=0; s<256; s++)
+				if (uint8_t(s+7)>=15) escapes += hist[s];
+			cost[NIBBLE] = n/2. + escapes;
+		}
+
+		for (size_t c=MARLIN+1; c<NUM_CODECS; c++)
+			cost[c] += frameOverhead;
+	}
+
+	uint8_t select(const uint8_t *in, size_t n) const {
+
+		std::array<double, NUM_CODECS> cost;
+		estimate(in, n, cost);
+
+		uint8_t best = RAW;
+		double bestCost = 0.99*n; // If we can not compress 1%, skip compression
+		if (cost[MARLIN] < bestCost) {
+			best = MARLIN;
+			bestCost = cost[MARLIN]*(1-marlinPreference);
+		}
+		for (uint8_t c=MARLIN+1; c<NUM_CODECS; c++) {
+			if (cost[c] < bestCost) {
+				best = c;
+				bestCost = cost[c];
+			}
+		}
+		return best;
+	}
+
+	// Single blocks are framed with the id of the codec picked, followed by the block framed by that codec.
+	size_t   compressBlock(const uint8_t *in, size_t n, uint8_t *out, int entropy __attribute__((unused)) = -1) const {
+
+		if (n>size_t(BlockSizeBytes)) throw std::runtime_error("single blocks are limited to BlockSizeBytes");
+
+		uint8_t id = select(in, n);
+		if (id == RAW) return storeBlock(in, n, out);
+
+		alignas(64) uint8_t block[BlockSizeBytes+4];
+		size_t compressedSize = codecs[id]->compressBlock(in, n, block);
+		if (block[0] == 255 or compressedSize >= n) return storeBlock(in, n, out);
+
+		memcpy(out+4, block, compressedSize);
+		return frameBlock(out, n, id, 0, compressedSize);
+	}
+
+	size_t uncompressBlock(const uint8_t *in, size_t n, uint8_t *out) const {
+
+		size_t sz = frameSize(in, n);
+		if (in[0] == 255) return CODEC8::uncompressBlock(in, n, out);
+		if (in[0] == RAW or in[0] >= NUM_CODECS or n<8) throw std::runtime_error("corrupted block");
+
+		if (codecs[in[0]]->uncompressBlock(in+4, n-4, out) != sz) throw std::runtime_error("corrupted block");
+		return sz;
+	}
+
+	size_t   compress(const UncompressedData8 &in, CompressedData8 &out) const {
+
+		size_t nBlocks = in.size();
+		out.resize(nBlocks+2);
+		out.back().reserve(nBlocks);
+		out.back().resize(nBlocks);
+		uint8_t *head = out.back().begin();
+
+		UncompressedData8 marlinIn;
+		std::vector<size_t> marlinBlocks;
+
+		for (size_t i=0; i<nBlocks; i++) {
+
+			const AlignedArray8 &block = in[i];
+			head[i] = select(block.data(), block.size());
+			if (head[i] == MARLIN) {
+				marlinIn.push_back(AlignedArray8::view(block.data(), block.size()));
+				marlinBlocks.push_back(i);
+				continue;
+			}
+			if (head[i] != RAW) {
+				out[i].resize(codecs[head[i]]->compressBlock(block.data(), block.size(), out[i].begin()));
+				if (out[i].size() <= block.size()) continue;
+			}
+			head[i] = RAW;
+			if (block.isView()) out[i] = AlignedArray8::view(block.data(), block.size());
+			else out[i] = block;
+		}
+
+		if (not marlinBlocks.empty()) {
+
+			CompressedData8 marlinOut;
+			codecs[MARLIN]->compress(marlinIn, marlinOut);
+			for (size_t k=0; k<marlinBlocks.size(); k++) {
+				// Blocks Marlin stores raw are views of the input, which may only be kept if it was a view.
+				size_t i = marlinBlocks[k];
+				if (marlinOut[k].isView() and not in[i].isView()) out[i] = marlinOut[k];
+				else out[i] = std::move(marlinOut[k]);
+			}
+			out[nBlocks] = std::move(marlinOut.back());
+		}
+
+		// Ids are only stored if some block is not Marlin, so that Hybrid costs nothing over Marlin alone.
+		if (marlinBlocks.size() == nBlocks) out.back().resize(0);
+
+		return out.nBytes();
+	}
+
+	size_t uncompress(const CompressedData8 &in, UncompressedData8 &out) const {
+
+		if (in.size()<2) throw std::runtime_error("corrupted header");
+		size_t nBlocks = in.size()-2;
+		out.resize(nBlocks);
+		const uint8_t *head = in.back().data();
+		bool allMarlin = in.back().size() != nBlocks;
+		if (allMarlin and in.back().size()) throw std::runtime_error("corrupted header");
+
+		CompressedData8 marlinIn;
+		std::vector<size_t> marlinBlocks;
+
+		for (size_t i=0; i<nBlocks; i++) {
+			
+			if (allMarlin or head[i] == MARLIN) {
+				marlinIn.push_back(AlignedArray8::view(in[i].data(), in[i].size()));
+				marlinBlocks.push_back(i);
+			} else if (head[i] == RAW) {
+				out[i] = in[i];
+			} else if (head[i] >= NUM_CODECS) {
+				throw std::runtime_error("corrupted header");
+			} else {
+				out[i].resize(codecs[head[i]]->uncompressBlock(in[i].data(), in[i].size(), out[i].begin()));
+			}
+		}
+
+		if (not marlinBlocks.empty()) {
+
+			marlinIn.push_back(AlignedArray8::view(in[nBlocks].data(), in[nBlocks].size()));
+			UncompressedData8 marlinOut;
+			codecs[MARLIN]->uncompress(marlinIn, marlinOut);
+			for (size_t k=0; k<marlinBlocks.size(); k++)
+				out[marlinBlocks[k]] = std::move(marlinOut[k]);
+		}
+
+		return out.nBytes();
+	}
+};
+
+Hybrid::Hybrid(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict, double marlinPreference) 
+	: CODEC8withPimpl( new HybridPimpl(distType, keySize, overlap, numDict, marlinPreference) ) {}
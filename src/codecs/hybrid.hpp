@@ -0,0 +1,15 @@
+#pragma once
+#include <util/codec.hpp>
+#include <util/distribution.hpp>
+
+// Picks, for each block, the cheapest of Marlin2018, Rice, RLE and Nibble by estimating their sizes from the block
+// histogram, and stores the block raw if none of them compresses it.
+struct Hybrid : public CODEC8withPimpl { 
+
+	Hybrid(
+		Distribution::Type distType = Distribution::Laplace, 
+		size_t keySize = 12, 
+		size_t overlap = 2,
+		size_t numDict = 11,
+		double marlinPreference = 0.1); // Fraction by which other codecs must beat Marlin, which decodes faster
+};
@@ -97,6 +97,9 @@ struct MarlinPimpl : public CODEC8Z {
 
 		std::vector<Word> W;
 		
+		// Longest word grown by tune(). Any maxWordSize above it tunes to this same dictionary.
+		size_t longestWord = 0;
+		
 		Dictionary(const std::vector<double> &P_, size_t dictSize2_, size_t maxWordSize_) :
 			P(P_), dictSize2(dictSize2_), maxWordSize(maxWordSize_) {
 
@@ -147,6 +150,8 @@ struct MarlinPimpl : public CODEC8Z {
 				
 				updatePcurrState();
 				
+				for (auto &w : W)
+					longestWord = std::max(longestWord, w.size());
 			}
 			
 			std::sort(W.begin(), W.end());
@@ -507,15 +512,30 @@ struct MarlinPimpl : public CODEC8Z {
 			for (auto &ds : distSorted)
 				P.emplace_back(ds.first);
 
-			double bestBitsPerSymbol = 1e10;
-			for (int maxWordLength=4; maxWordLength <= 128; maxWordLength*=2) {
-
+			auto newDictionary = [&](size_t maxWordLength) {
 				std::shared_ptr<Dictionary> dict;
 				if (dictType == Marlin::TUNSTALL) dict.reset(new TunstallDictionary(P, dictSize2, maxWordLength));
 				if (dictType == Marlin::MARLIN) dict.reset(new MarlinDictionary(P, dictSize2, maxWordLength));
+				return dict;
+			};
+
+			// The largest dictionary is tuned first. Shorter caps that its words never reach tune to the same
+			// words, so only caps below its longest word are tuned on their own.
+			auto largest = newDictionary(128);
+			largest->tune();
+			double largestBitsPerSymbol = largest->averageBitsPerSymbol();
 
-				dict->tune();
-				double averageBitsPerSymbol = dict->averageBitsPerSymbol();
+			double bestBitsPerSymbol = 1e10;
+			int bestWordLength = 0;
+			for (int maxWordLength=4; maxWordLength <= 128; maxWordLength*=2) {
+
+				std::shared_ptr<Dictionary> dict;
+				double averageBitsPerSymbol = largestBitsPerSymbol;
+				if (maxWordLength < 128 and largest->longestWord >= size_t(maxWordLength-1)) {
+					dict = newDictionary(maxWordLength);
+					dict->tune();
+					averageBitsPerSymbol = dict->averageBitsPerSymbol();
+				}
 				
 //				std::cerr << "P: " << p << " " << maxWordLength << " " << averageBitsPerSymbol << std::endl;
 
@@ -523,6 +543,12 @@ struct MarlinPimpl : public CODEC8Z {
 				
 				builtDictionaries[p] = dict;
 				bestBitsPerSymbol = averageBitsPerSymbol;
+				bestWordLength = maxWordLength;
+			}
+			
+			if (not builtDictionaries[p]) {
+				builtDictionaries[p] = newDictionary(bestWordLength);
+				builtDictionaries[p]->tune(largest->W);
 			}
 			
 			builtEncoders[p] = std::make_shared<Encoder>(*builtDictionaries[p], distSorted);
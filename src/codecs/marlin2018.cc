@@ -16,52 +16,92 @@
 #include <algorithm>
 #include <memory>
 
-struct Marlin2018Pimpl : public CODEC8Z {
+struct Marlin2018Pimpl : public CODEC8Zstatic<Marlin2018Pimpl> {
 	
 	std::vector<std::shared_ptr<Marlin2018Simple>> dictionaries;
+
+	// Shape aware selection: the header byte indexes the dictionary bank directly, and each
+	// dictionary carries a table with the estimated cost in bits of coding each symbol.
+	bool shapeAware;
+	std::vector<std::array<float,256>> costTables;
+
+	// Blocks are parsed optimally instead of greedily, which is slower to encode but never larger.
+	bool optimalParse;
 	
 	std::string coderName;
 	std::string name() const { return coderName; }
 	
-	Marlin2018Pimpl(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict) {
+	static std::shared_ptr<Marlin2018Simple> buildDictionary(const std::vector<double> &pdf, size_t keySize, size_t overlap) {
+
+		return Marlin2018Simple::withBestWordSize(pdf, keySize, overlap);
+	}
+
+	static std::vector<double> trainingPdf(Distribution::Type distType, size_t p, size_t numDict) {
+		
+		std::vector<double> pdf(256,0.);
+		for (double i=0.05; i<0.99; i+=0.1) {
+			
+//			auto pdf0 = Distribution::pdf(distType, (p+0.5)/numDict);
+			auto pdf0 = Distribution::pdf(distType, (p+i)/numDict);
+			for (size_t j=0; j<pdf.size(); j++)
+				pdf[j] += pdf0[j]/10.;
+		}
+		//double ss = 0; for (auto &p : pdf) ss+=p; std::cerr << ss << std::endl;
+		return pdf;
+	}
+	
+	Marlin2018Pimpl(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict, bool shapeAware_, bool modeShift, bool optimalParse_) : shapeAware(shapeAware_), optimalParse(optimalParse_) {
+
+		enableModeShift = modeShift;
+		enableInPlace = Marlin2018Simple::configuration("inPlace");
 
 		{
 			std::ostringstream oss;
-			oss << "Marlin2018 " << (distType==Distribution::Laplace?"Lap:":"Exp:") <<  ":" << keySize << ":" << overlap << ":" << numDict;
+			oss << "Marlin2018 " << (shapeAware?"Shape:":(distType==Distribution::Laplace?"Lap:":"Exp:")) <<  ":" << keySize << ":" << overlap << ":" << numDict << (modeShift?":Shift":"") << (optimalParse?":Opt":"");
 			coderName = oss.str();
 		}
-
-		std::vector<std::shared_ptr<Marlin2018Simple>> builtDictionaries(numDict);
-
-//		#pragma omp parallel for
-		for (size_t p=0; p<numDict; p++) {
-			
-			std::vector<double> pdf(256,0.);
-			for (double i=0.05; i<0.99; i+=0.1) {
-				
-//				auto pdf0 = Distribution::pdf(distType, (p+0.5)/numDict);
-				auto pdf0 = Distribution::pdf(distType, (p+i)/numDict);
-				for (size_t j=0; j<pdf.size(); j++)
-					pdf[j] += pdf0[j]/10.;
-			}
-					
-			//double ss = 0; for (auto &p : pdf) ss+=p; std::cerr << ss << std::endl;
+		
+		if (shapeAware) {
 			
-			double bestEfficiency = Marlin2018Simple::theoreticalEfficiency(pdf, keySize, overlap, 4-1);
-			size_t bestWordLength = 4;
-			for (int maxWordLength=8; maxWordLength <= 512; maxWordLength*=2) {
-				
-				std::cerr << "Test: " << keySize << " " << overlap << " " << maxWordLength-1 << std::endl;
-
-				double efficiency = Marlin2018Simple::theoreticalEfficiency(pdf, keySize, overlap, maxWordLength-1);
-				if (bestEfficiency+0.005 > efficiency) 
-					break;
+			// One bank covering all distribution families. Header values 0 and 255 are reserved by CODEC8Z.
+			std::vector<Distribution::Type> types = { Distribution::Gaussian, Distribution::Laplace, Distribution::Exponential, Distribution::Poisson };
+			if (types.size()*numDict > 254) 
+				throw std::runtime_error("too many dictionaries for a one byte header");
 
-				bestEfficiency = std::max(efficiency, bestEfficiency);
-				bestWordLength = maxWordLength;
+			dictionaries.resize(256);
+			costTables.resize(256);
+			for (size_t t=0; t<types.size(); t++) {
+				for (size_t p=0; p<numDict; p++) {
+					
+					size_t idx = 1 + t*numDict + p;
+					auto pdf = trainingPdf(types[t], p, numDict);
+					auto dict = buildDictionary(pdf, keySize, overlap);
+					
+					// The cost tables use the empirical efficiency of the dictionary on its own training distribution. 
+					// Dictionaries that fail to compress their own distribution are left out of the bank.
+					auto testData = Distribution::getResiduals(pdf, 1<<16);
+					std::string out;
+					dict->encode(testData, out);
+					if (out.size() > testData.size()*0.99) 
+						continue;
+					
+					double efficiency = Distribution::entropy(pdf)*testData.size()/(8.*out.size());
+					
+					// Symbols pruned from the dictionary are coded through the victim dictionary,
+					// which costs at most two keys.
+					dictionaries[idx] = dict;
+					for (size_t s=0; s<256; s++)
+						costTables[idx][s] = std::min(-std::log2(pdf[s])/efficiency, 2.*keySize);
+				}
 			}
-			builtDictionaries[p] = std::make_shared<Marlin2018Simple>(pdf, keySize, overlap, bestWordLength-1);
+			return;
 		}
+
+		std::vector<std::shared_ptr<Marlin2018Simple>> builtDictionaries(numDict);
+
+//		#pragma omp parallel for
+		for (size_t p=0; p<numDict; p++)
+			builtDictionaries[p] = buildDictionary(trainingPdf(distType, p, numDict), keySize, overlap);
 		
 		dictionaries.resize(256);
 		
@@ -83,17 +123,52 @@ struct Marlin2018Pimpl : public CODEC8Z {
 		}
 	}
 
+	// Picks the dictionary with the lowest estimated cost for the block, returns 0 if none compresses.
+	uint8_t selectDictionary(const uint8_t *in, size_t n) const {
+		
+		std::array<uint32_t,256> hist; hist.fill(0);
+		for (size_t j=0; j<n; j++) hist[in[j]]++;
+		
+		std::vector<std::pair<uint8_t,uint32_t>> used;
+		for (size_t s=0; s<256; s++)
+			if (hist[s]) used.emplace_back(s, hist[s]);
+		
+		uint8_t best = 0;
+		double bestCost = 8*0.99*n; // If we can not compress 1%, skip compression
+		for (size_t d=1; d<255; d++) {
+			if (not dictionaries[d]) continue;
+			
+			double cost = 0;
+			for (auto &&u : used)
+				cost += u.second*costTables[d][u.first];
+			
+			if (cost < bestCost) {
+				bestCost = cost;
+				best = d;
+			}
+		}
+		return best;
+	}
 	
 	void   compress(
 		const std::vector<std::reference_wrapper<const AlignedArray8>> &in,
 		      std::vector<std::reference_wrapper<      AlignedArray8>> &out,
 		      std::vector<std::reference_wrapper<      uint8_t      >> &entropy) const { 
 		
-		for (size_t i=0; i<in.size(); i++)
+		for (size_t i=0; i<in.size(); i++) {
+			
+			if (shapeAware) {
+
+				uint8_t d = selectDictionary(in[i].get().data(), in[i].get().size());
+				if (d) entropy[i].get() = d;
+				else { out[i].get().resize(in[i].get().size()); continue; }
+			}
+
 			if (dictionaries[entropy[i]])
-				dictionaries[entropy[i]]->encode(in[i].get(), out[i].get());
+				dictionaries[entropy[i]]->encode(in[i].get(), out[i].get(), optimalParse);
 			else
 				out[i].get().resize(in[i].get().size());
+		}
 	}
 
 	void uncompress(
@@ -108,9 +183,151 @@ struct Marlin2018Pimpl : public CODEC8Z {
 				out[i].get().resize(in[i].get().size());
 	}
 
+	size_t compressPacket(const uint8_t *in, size_t n, uint8_t *out, uint8_t &entropy) const {
+
+		if (shapeAware) {
+
+			uint8_t d = selectDictionary(in, n);
+			if (not d) return n;
+			entropy = d;
+		}
+		return dictionaries[entropy] ? dictionaries[entropy]->encode(in, n, out, optimalParse) : n;
+	}
+
+	void uncompressPacket(const uint8_t *in, size_t n, uint8_t *out, size_t outSize __attribute__((unused)), uint8_t entropy) const {
+
+		if (dictionaries[entropy])
+			dictionaries[entropy]->decode(in, n, out);
+	}
+
+	bool uncompressBlockInPlace(uint8_t *buffer, size_t capacity, size_t compressedSize, size_t n __attribute__((unused)), uint8_t entropy) const {
+
+		return dictionaries[entropy] and dictionaries[entropy]->decodeInPlace(buffer, capacity, compressedSize) >= 0;
+	}
+
+	size_t inPlaceMargin(const AlignedArray8 &in, size_t n __attribute__((unused)), uint8_t entropy) const {
+
+		return dictionaries[entropy] ? dictionaries[entropy]->inPlaceMargin(in) : SIZE_MAX/2;
+	}
+
+};
+
+
+struct Marlin2018Pimpl16 : public CODEC16 {
+	
+	// The scale of dictionary p is minScale*2^(p/2)
+	constexpr static const double minScale = 0.25;
+
+	std::vector<std::shared_ptr<Marlin2018Simple>> dictionaries;
+	
+	std::string coderName;
+	std::string name() const { return coderName; }
+	
+	Marlin2018Pimpl16(size_t keySize, size_t overlap, size_t numDict) {
+
+		{
+			std::ostringstream oss;
+			oss << "Marlin2018_16 Lap:" << keySize << ":" << overlap << ":" << numDict;
+			coderName = oss.str();
+		}
+		
+		// Header values 0 and 255 are reserved for zero and raw blocks.
+		if (numDict > 254) 
+			throw std::runtime_error("too many dictionaries for a one byte header");
+		if (numDict == 0) 
+			throw std::runtime_error("Marlin2018_16 needs at least one dictionary");
+
+		dictionaries.resize(numDict);
+		for (size_t p=0; p<numDict; p++) {
+
+			auto pdf = Distribution::pdfByType(1<<16, Distribution::Laplace, minScale*std::pow(2., p/2.));
+			dictionaries[p] = Marlin2018Pimpl::buildDictionary(pdf, keySize, overlap);
+		}
+	}
+	
+	// The header holds the dictionary of each block, then the number of values of the last block.
+	size_t   compress(const UncompressedData16 &in, CompressedData8 &out) const {
+
+		out.resize(in.size()+1);
+		out.back().reserve(in.size()+4);
+		out.back().resize(in.size()+4);
+		uint8_t *head = out.back().begin();
+		
+		uint32_t lastSize = in.empty() ? 0 : in.back().size();
+		memcpy(head+in.size(), &lastSize, 4);
+		
+		for (size_t i=0; i<in.size(); i++) {
+			
+			const AlignedArray16 &block = in[i];
+			
+			// Mean absolute residual, which is the scale of a Laplacian distribution.
+			double scale = 0;
+			for (size_t j=1; j<block.size(); j++)
+				scale += std::abs(int16_t(block[j]));
+			scale /= block.size();
+			
+			if (scale == 0) {
+				
+				out[i].resize(2);
+				memcpy(out[i].begin(), block.data(), 2);
+				head[i] = 0;
+				continue;
+			}
+			
+			// Scales past the last dictionary are coded with it, its victim dictionary takes the outliers.
+			size_t p = std::min(dictionaries.size()-1, size_t(std::max(0., std::round(2*std::log2(scale/minScale)))));
+			dictionaries[p]->encode(block, out[i]);
+			head[i] = 1+p;
+			
+			// If we achieve at least 1% compression, we keep the compressed one.
+			if (out[i].size() < 0.99*2*block.size())
+				continue;
+			
+			out[i].reserve(2*block.size());
+			out[i].resize(2*block.size());
+			memcpy(out[i].begin(), block.data(), 2*block.size());
+			head[i] = 255;
+		}
+		
+		return out.nBytes();
+	}
+
+	size_t uncompress(const CompressedData8 &in, UncompressedData16 &out) const {
+
+		out.resize(in.size()-1);
+		const uint8_t *head = in.back().data();
+		if (in.back().size() != out.size()+4) throw std::runtime_error("corrupted header");
+		
+		uint32_t lastSize;
+		memcpy(&lastSize, head+out.size(), 4);
+		if (lastSize > blockSizeBytes()/sizeof(uint16_t)) throw std::runtime_error("corrupted header");
+		if (not out.empty()) out.back().resize(lastSize);
+		
+		for (size_t i=0; i<out.size(); i++) {
+
+			if        (head[i] == 255) {
+			
+				out[i].reserve(in[i].size()/2);
+				out[i].resize(in[i].size()/2);
+				memcpy(out[i].begin(), in[i].data(), 2*out[i].size());
+			} else if (head[i] == 0  ) {
+				
+				memset(out[i].begin(), 0, 2*out[i].size());
+				memcpy(out[i].begin(), in[i].data(), 2);
+			} else {
+				
+				if (size_t(head[i]-1) >= dictionaries.size()) throw std::runtime_error("corrupted header");
+				dictionaries[head[i]-1]->decode(in[i], out[i]);
+			}
+		}
+		
+		return out.nBytes();				
+	}
 };
 
 
-Marlin2018::Marlin2018(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict) 
-	: CODEC8withPimpl( new Marlin2018Pimpl(distType, keySize, overlap, numDict) ) {}
+Marlin2018::Marlin2018(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict, bool shapeAware, bool modeShift, bool optimalParse) 
+	: CODEC8withPimpl( new Marlin2018Pimpl(distType, keySize, overlap, numDict, shapeAware, modeShift, optimalParse) ) {}
 
+Marlin2018_16::Marlin2018_16(size_t keySize, size_t overlap, size_t numDict) 
+	: CODEC16withPimpl( new Marlin2018Pimpl16(keySize, overlap, numDict) ) {}
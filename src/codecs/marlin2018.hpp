@@ -8,5 +8,17 @@ struct Marlin2018 : public CODEC8withPimpl {
 		Distribution::Type distType = Distribution::Laplace, 
 		size_t keySize = 12, 
 		size_t overlap = 2,
-		size_t numDict = 11);	
+		size_t numDict = 11,
+		bool shapeAware = false, // Selects among dictionaries of all Distribution::Type families by estimated block cost
+		bool modeShift = false,  // Shifts off-center blocks so their mode is coded as 0, see CODEC8Z
+		bool optimalParse = false); // Parses blocks optimally instead of greedily: smaller, slower to encode
+};
+
+// 16 bit residuals. Dictionaries are built for Laplacian distributions of geometrically increasing scale.
+struct Marlin2018_16 : public CODEC16withPimpl { 
+
+	Marlin2018_16(
+		size_t keySize = 12, 
+		size_t overlap = 2,
+		size_t numDict = 16);
 };
@@ -0,0 +1,267 @@
+#include <codecs/marlinlz.hpp>
+#include <codecs/marlin2018.hpp>
+
+#include <array>
+#include <memory>
+#include <cstring>
+#include <sstream>
+
+#ifdef __SSSE3__
+#include <immintrin.h>
+#endif
+
+struct MarlinLZPimpl : public CODEC8 {
+
+	// Header byte of each block.
+	enum { RAW = 0, LZ, MARLIN };
+
+	// A sequence costs about 3 bytes, which is what a dozen literals cost on typical residuals.
+	static const size_t MinMatch = 12, HashBits = 12;
+
+	// Literals are residuals; lengths are small positive counts, closer to an exponential distribution.
+	std::shared_ptr<CODEC8> literalCodec, lengthCodec;
+
+	std::string coderName;
+	std::string name() const { return coderName; }
+
+	MarlinLZPimpl(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict) {
+
+		literalCodec = std::make_shared<Marlin2018>(distType, keySize, overlap, numDict);
+		lengthCodec  = std::make_shared<Marlin2018>(Distribution::Exponential, keySize, overlap, numDict);
+
+		std::ostringstream oss;
+		oss << "MarlinLZ " << literalCodec->name().substr(11);
+		coderName = oss.str();
+	}
+
+	// Blocks go through the single block API of Marlin2018.
+	void setBlockSizeBytes(size_t n) {
+
+		if (n>size_t(BlockSizeBytes)) throw std::runtime_error("MarlinLZ blocks are limited to BlockSizeBytes");
+		CODEC8::setBlockSizeBytes(n);
+	}
+
+	// For offsets below 16, the byte of the match source at each position of a 16 byte pattern, and the 
+	// largest multiple of the offset that fits in the pattern.
+	alignas(16) static const uint8_t Cycles[16][16];
+	static const uint8_t Steps[16];
+
+	static uint32_t hash(const uint8_t *p) { 
+		
+		uint64_t v; 
+		memcpy(&v, p, 8); 
+		return (v*0x9E3779B97F4A7C15ULL) >> (64-HashBits); 
+	}
+
+	static uint8_t *putLength(uint8_t *l, size_t v) {
+
+		while (v>=255) { *l++ = 255; v -= 255; }
+		*l++ = v;
+		return l;
+	}
+
+	static size_t getLength(const uint8_t *&l) {
+
+		size_t r = 0;
+		while (*l == 255) r += *l++;
+		return r + *l++;
+	}
+
+	// Sequences of a block: a literal run followed by a match of at least MinMatch bytes. The literals after 
+	// the last match are implicit. There are at most n/MinMatch sequences, and their lengths take less than n bytes.
+	struct Sequences {
+		size_t nSeq = 0, nLiterals = 0, nLengths = 0;
+		alignas(64) uint8_t literals[BlockSizeBytes], lengths[BlockSizeBytes];
+		uint16_t offsets[BlockSizeBytes/MinMatch];
+	};
+
+	// Greedy parse, with the last position of each hash as the only candidate.
+	static void parse(const uint8_t *in, size_t n, Sequences &seq) {
+
+		std::array<uint16_t, 1<<HashBits> table; table.fill(0xFFFF);
+		
+		uint8_t *lit = seq.literals, *len = seq.lengths;
+		size_t anchor = 0, i = 0;
+		while (i+MinMatch <= n) {
+
+			uint32_t h = hash(in+i);
+			size_t candidate = table[h];
+			table[h] = i;
+			
+			if (candidate == 0xFFFF or memcmp(in+candidate, in+i, MinMatch)) {
+				i++;
+				continue;
+			}
+
+			size_t m = MinMatch;
+			while (i+m<n and in[candidate+m] == in[i+m]) m++;
+
+			memcpy(lit, in+anchor, i-anchor);
+			lit += i-anchor;
+			len = putLength(len, i-anchor);
+			len = putLength(len, m-MinMatch);
+			seq.offsets[seq.nSeq++] = i-candidate;
+
+			for (size_t j=i+1; j<i+m and j+MinMatch<=n; j++) table[hash(in+j)] = j;
+			i += m;
+			anchor = i;
+		}
+		memcpy(lit, in+anchor, n-anchor);
+		seq.nLiterals = lit + n - anchor - seq.literals;
+		seq.nLengths = len - seq.lengths;
+	}
+
+	// LZ payload: number of sequences, sizes of the literal and length frames, the frames, and the offsets.
+	// Returns SIZE_MAX if the block has no matches.
+	size_t compressLZ(const uint8_t *in, size_t n, uint8_t *out) const {
+
+		Sequences seq;
+		parse(in, n, seq);
+		if (seq.nSeq == 0) return SIZE_MAX;
+
+		uint16_t head[3];
+		uint8_t *o = out + sizeof(head);
+		head[0] = seq.nSeq;
+		head[1] = literalCodec->compressBlock(seq.literals, seq.nLiterals, o);
+		o += head[1];
+		head[2] = lengthCodec->compressBlock(seq.lengths, seq.nLengths, o);
+		o += head[2];
+		memcpy(o, seq.offsets, 2*seq.nSeq);
+		memcpy(out, head, sizeof(head));
+		return o + 2*seq.nSeq - out;
+	}
+
+	// Returns the decoded size, which is the number of literals plus the match lengths.
+	size_t uncompressLZ(const uint8_t *in, uint8_t *out) const {
+
+		uint16_t head[3];
+		memcpy(head, in, sizeof(head));
+		const uint8_t *i = in + sizeof(head);
+
+		alignas(64) uint8_t literals[BlockSizeBytes+64], lengths[BlockSizeBytes+64];
+		size_t nLiterals = literalCodec->uncompressBlock(i, head[1], literals);
+		i += head[1];
+		lengthCodec->uncompressBlock(i, head[2], lengths);
+		i += head[2];
+		const uint8_t *offsets = i, *lit = literals, *len = lengths;
+		
+		// Matches are copied 16 bytes at a time, which writes up to 15 bytes past the block.
+		uint8_t *o = out;
+		for (size_t s=0; s<head[0]; s++) {
+
+			size_t nLit = getLength(len);
+			if (nLit <= 16) memcpy(o, lit, 16);
+			else memcpy(o, lit, nLit);
+			o += nLit;
+			lit += nLit;
+
+			size_t nMatch = getLength(len) + MinMatch;
+			uint16_t offset; 
+			memcpy(&offset, offsets + 2*s, 2);
+			// Matches closer than 16 bytes repeat a pattern, which is built once and stored from a register.
+			const uint8_t *m = o - offset;
+			if (offset < 16) {
+#ifdef __SSSE3__
+				__m128i pattern = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)m), _mm_load_si128((const __m128i *)Cycles[offset]));
+				for (size_t j=0, step=Steps[offset]; j<nMatch; j+=step) _mm_storeu_si128((__m128i *)(o+j), pattern);
+#else
+				uint8_t pattern[16];
+				for (size_t j=0; j<16; j++) pattern[j] = m[Cycles[offset][j]];
+				for (size_t j=0, step=Steps[offset]; j<nMatch; j+=step) memcpy(o+j, pattern, 16);
+#endif
+			} else {
+				for (size_t j=0; j<nMatch; j+=16) memcpy(o+j, m+j, 16);
+			}
+			o += nMatch;
+		}
+		size_t nTail = literals + nLiterals - lit;
+		memcpy(o, lit, nTail);
+		return o + nTail - out;
+	}
+
+	// Codes the block with the smaller of LZ and plain Marlin, or returns RAW if none of them compresses 1%.
+	// Both candidates are coded in scratch buffers, as an LZ payload may be larger than the block.
+	uint8_t encode(const uint8_t *in, size_t n, uint8_t *out, size_t &outSize) const {
+
+		alignas(64) uint8_t lz[2*BlockSizeBytes+16], plain[BlockSizeBytes+4];
+		size_t lzSize = compressLZ(in, n, lz);
+		size_t plainSize = literalCodec->compressBlock(in, n, plain);
+		
+		outSize = std::min(lzSize, plainSize);
+		if (outSize >= 0.99*n) return RAW;
+		memcpy(out, lzSize < plainSize ? lz : plain, outSize);
+		return lzSize < plainSize ? LZ : MARLIN;
+	}
+
+	size_t decode(const uint8_t *in, size_t n, uint8_t *out, uint8_t head) const {
+
+		if (head == MARLIN) return literalCodec->uncompressBlock(in, n, out);
+		return uncompressLZ(in, out);
+	}
+
+	size_t   compress(const UncompressedData8 &in, CompressedData8 &out) const {
+
+		out.resize(in.size()+1);
+		out.back().reserve(in.size());
+		out.back().resize(in.size());
+		uint8_t *head = out.back().begin();
+
+		for (size_t i=0; i<in.size(); i++) {
+
+			const AlignedArray8 &block = in[i];
+			size_t sz;
+			out[i].reserve(block.size());
+			head[i] = encode(block.data(), block.size(), out[i].begin(), sz);
+			if (head[i] != RAW) {
+				out[i].resize(sz);
+			} else if (block.isView()) {
+				out[i] = AlignedArray8::view(block.data(), block.size());
+			} else {
+				out[i] = block;
+			}
+		}
+
+		return out.nBytes();
+	}
+
+	size_t uncompress(const CompressedData8 &in, UncompressedData8 &out) const {
+
+		out.resize(in.size()-1);
+		const uint8_t *head = in.back().data();
+
+		for (size_t i=0; i<out.size(); i++) {
+
+			if (head[i] == RAW) 
+				out[i] = in[i];
+			else
+				out[i].resize(decode(in[i].data(), in[i].size(), out[i].begin(), head[i]));
+		}
+
+		return out.nBytes();
+	}
+
+	virtual size_t   compressBlock(const uint8_t *in, size_t n, uint8_t *out, int entropy __attribute__((unused)) = -1) const {
+
+		size_t sz;
+		uint8_t head = encode(in, n, out+4, sz);
+		if (head == RAW) return storeBlock(in, n, out);
+		return frameBlock(out, n, head, 0, sz);
+	}
+
+	virtual size_t uncompressBlock(const uint8_t *in, size_t n, uint8_t *out) const {
+
+		size_t sz = frameSize(in, n);
+		if (in[0]==255) return CODEC8::uncompressBlock(in, n, out);
+		if (decode(in+4, n-4, out, in[0]) != sz) throw std::runtime_error("corrupted block");
+		return sz;
+	}
+};
+
+#define C(o) { 0%o, 1%o, 2%o, 3%o, 4%o, 5%o, 6%o, 7%o, 8%o, 9%o, 10%o, 11%o, 12%o, 13%o, 14%o, 15%o }
+alignas(16) const uint8_t MarlinLZPimpl::Cycles[16][16] = { 
+	{}, C(1), C(2), C(3), C(4), C(5), C(6), C(7), C(8), C(9), C(10), C(11), C(12), C(13), C(14), C(15) };
+#undef C
+const uint8_t MarlinLZPimpl::Steps[16] = { 0, 16, 16, 15, 16, 15, 12, 14, 16, 9, 10, 11, 12, 13, 14, 15 };
+
+MarlinLZ::MarlinLZ(Distribution::Type distType, size_t keySize, size_t overlap, size_t numDict) 
+	: CODEC8withPimpl( new MarlinLZPimpl(distType, keySize, overlap, numDict) ) {}
@@ -0,0 +1,15 @@
+#pragma once
+#include <util/codec.hpp>
+#include <util/distribution.hpp>
+
+// LZ77 within each block, with the literals and the match lengths coded by Marlin2018. Offsets are stored raw.
+// Blocks without profitable matches are coded by Marlin2018 alone. Blocks are limited to BlockSizeBytes (4 KiB),
+// the size of its stack buffers and of the single block API: setBlockSizeBytes throws above it.
+struct MarlinLZ : public CODEC8withPimpl { 
+
+	MarlinLZ(
+		Distribution::Type distType = Distribution::Laplace, 
+		size_t keySize = 12, 
+		size_t overlap = 2,
+		size_t numDict = 11);
+};
@@ -17,8 +17,11 @@ class NibblePimpl : public CODEC8AA {
 	
 	std::string name() const { return "Nibble"; }
 
+	// Blocks are coded 16 bytes at a time, so short last blocks of other lengths are stored raw.
 	void   compress(const AlignedArray8 &I, AlignedArray8 &O) const {
 
+		if (I.size()%16) { O = I; return; }
+
 		const uint16_t *i    = (const uint16_t *)I.begin();
 		const uint16_t *iEnd = (const uint16_t *)I.end();
 		uint8_t  *o = O.begin();
@@ -35,6 +38,8 @@ class NibblePimpl : public CODEC8AA {
 
 	void uncompress(const AlignedArray8 &I, AlignedArray8 &O) const {
 
+		if (O.size()%16) { O = I; return; }
+
 		const uint8_t *i = I.begin();
 		uint8_t *o       = O.begin();
 		uint8_t *oEnd    = O.end();
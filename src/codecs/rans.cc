@@ -0,0 +1,192 @@
+#include <codecs/rans.hpp>
+#include <util/distribution.hpp>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+// A packet is the final state of each lane, followed by the 16 bit renormalization words in the order the decoder 
+// reads them. Symbol i goes through lane i%Lanes; within a round, lanes renormalize in increasing order.
+struct RansPimpl : public CODEC8Zstatic<RansPimpl> {
+
+	static const size_t SPLITS = 64, Lanes = 16;
+	static const uint32_t ProbBits = 14, ProbScale = 1<<ProbBits, RansL = 1<<16;
+
+	struct Table {
+		uint32_t symbol[256];                     // Frequency in the low 16 bits, cumulative frequency in the high ones
+		uint8_t slot[ProbScale + 4];              // Symbol of each slot, padded for 32 bit gathers
+	};
+	std::vector<Table> tables;
+
+#ifdef __AVX2__
+	// Lane of the loaded words that each lane takes when the lanes in the mask renormalize.
+	uint32_t renormPermutation[256][8];
+#endif
+
+	std::string name() const { return "rANS"; }
+
+	// Quantizes the pdf to ProbScale, keeping every symbol codable. The rounding error goes to the most probable symbol.
+	static std::array<uint32_t,256> quantize(const std::array<double,256> &pdf) {
+
+		std::array<uint32_t,256> freq;
+		int64_t total = 0;
+		for (size_t s=0; s<256; s++) 
+			total += freq[s] = std::max(1., std::round(pdf[s]*ProbScale));
+		
+		size_t mode = std::max_element(pdf.begin(), pdf.end()) - pdf.begin();
+		freq[mode] += int64_t(ProbScale) - total;
+		return freq;
+	}
+
+	RansPimpl(Distribution::Type distType) : tables(SPLITS) {
+
+		enableModeShift = true;
+
+		for (size_t split=0; split<SPLITS; split++) {
+
+			auto freq = quantize(Distribution::pdf(distType, (split+0.5)/SPLITS));
+			
+			Table &t = tables[split];
+			memset(t.slot, 0, sizeof(t.slot));
+			uint32_t start = 0;
+			for (size_t s=0; s<256; s++) {
+				t.symbol[s] = freq[s] | (start<<16);
+				memset(t.slot + start, s, freq[s]);
+				start += freq[s];
+			}
+		}
+
+#ifdef __AVX2__
+		for (size_t mask=0; mask<256; mask++)
+			for (size_t lane=0, word=0; lane<8; lane++)
+				renormPermutation[mask][lane] = (mask>>lane)&1 ? word++ : 0;
+#endif
+	}
+
+	// Encodes n symbols into at most n bytes. Returns the encoded size, or n if it does not fit. The stream is 
+	// built backwards from the end of out and then moved to its start.
+	size_t compressPacket(const uint8_t *in, size_t n, uint8_t *out, uint8_t &entropy) const {
+
+		const Table &t = tables[entropy*SPLITS/256];
+
+		uint32_t x[Lanes];
+		std::fill(x, x+Lanes, RansL);
+
+		uint8_t *o = out + n;
+		for (size_t i=n; i-- > 0;) {
+
+			uint32_t &s = x[i%Lanes];
+			uint32_t freq = t.symbol[in[i]] & 0xFFFF, start = t.symbol[in[i]] >> 16;
+			
+			if (s >= ((RansL >> ProbBits) << 16) * freq) {
+				if (o-out < 2) return n;
+				o -= 2;
+				uint16_t w = s;
+				memcpy(o, &w, 2);
+				s >>= 16;
+			}
+			s = ((s / freq) << ProbBits) + (s % freq) + start;
+		}
+
+		if (size_t(o-out) < sizeof(x)) return n;
+		o -= sizeof(x);
+		memcpy(o, x, sizeof(x));
+
+		size_t sz = out + n - o;
+		memmove(out, o, sz);
+		return sz;
+	}
+
+	static uint8_t decodeSymbol(const Table &t, uint32_t &x, const uint16_t *&words) {
+
+		uint32_t slot = x & (ProbScale-1);
+		uint8_t s = t.slot[slot];
+		x = (t.symbol[s] & 0xFFFF) * (x >> ProbBits) + slot - (t.symbol[s] >> 16);
+		if (x < RansL) x = (x << 16) | *words++;
+		return s;
+	}
+
+#ifdef __AVX2__
+	// Decodes 8 lanes, and renormalizes them from the next words of the stream.
+	__m256i decodeLanes(const Table &t, __m256i &x, const uint16_t *&words) const {
+
+		__m256i slot = _mm256_and_si256(x, _mm256_set1_epi32(ProbScale-1));
+		__m256i s = _mm256_and_si256(_mm256_i32gather_epi32((const int *)t.slot, slot, 1), _mm256_set1_epi32(0xFF));
+		__m256i symbol = _mm256_i32gather_epi32((const int *)t.symbol, s, 4);
+		
+		__m256i freq = _mm256_and_si256(symbol, _mm256_set1_epi32(0xFFFF));
+		__m256i start = _mm256_srli_epi32(symbol, 16);
+		x = _mm256_add_epi32(_mm256_mullo_epi32(freq, _mm256_srli_epi32(x, ProbBits)), _mm256_sub_epi32(slot, start));
+
+		__m256i renorm = _mm256_cmpeq_epi32(_mm256_srli_epi32(x, 16), _mm256_setzero_si256());
+		int mask = _mm256_movemask_ps(_mm256_castsi256_ps(renorm));
+		__m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)words));
+		w = _mm256_permutevar8x32_epi32(w, _mm256_loadu_si256((const __m256i *)renormPermutation[mask]));
+		x = _mm256_blendv_epi8(x, _mm256_or_si256(_mm256_slli_epi32(x, 16), w), renorm);
+		words += __builtin_popcount(mask);
+		return s;
+	}
+#endif
+
+	// Decodes n symbols. The stream is read up to 16 bytes past its end.
+	void uncompress(const uint8_t *in, uint8_t *o8, size_t n, uint8_t entropy) const {
+
+		const Table &t = tables[entropy*SPLITS/256];
+		
+		uint32_t x[Lanes];
+		memcpy(x, in, sizeof(x));
+		const uint16_t *words = (const uint16_t *)(in + sizeof(x));
+
+		size_t i = 0;
+#ifdef __AVX2__
+		__m256i x0 = _mm256_loadu_si256((const __m256i *)x), x1 = _mm256_loadu_si256((const __m256i *)(x+8));
+		for (; i+Lanes<=n; i+=Lanes) {
+
+			__m256i s0 = decodeLanes(t, x0, words);
+			__m256i s1 = decodeLanes(t, x1, words);
+
+			__m256i s = _mm256_permute4x64_epi64(_mm256_packus_epi32(s0, s1), 0xD8);
+			_mm_storeu_si128((__m128i *)(o8+i), _mm_packus_epi16(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1)));
+		}
+		_mm256_storeu_si256((__m256i *)x, x0);
+		_mm256_storeu_si256((__m256i *)(x+8), x1);
+#endif
+		for (; i<n; i++)
+			o8[i] = decodeSymbol(t, x[i%Lanes], words);
+	}
+
+	// The arrays have slack for the read ahead, so packets are decoded in place instead of through the copy of 
+	// uncompressPacket.
+	void uncompress(
+		const std::vector<std::reference_wrapper<const AlignedArray8>> &in,
+		      std::vector<std::reference_wrapper<      AlignedArray8>> &out,
+		      std::vector<std::reference_wrapper<const uint8_t      >> &entropy) const {
+		
+		for (size_t j=0; j<out.size(); j++)
+			uncompress(in[j].get().data(), out[j].get().begin(), out[j].get().size(), entropy[j]);
+	}
+
+	void uncompressPacket(const uint8_t *in, size_t n, uint8_t *out, size_t outSize, uint8_t entropy) const {
+
+		// The decoder reads ahead of the stream.
+		alignas(32) uint8_t buffer[BlockSizeBytes+16];
+		std::vector<uint8_t> largeBuffer;
+		uint8_t *stream = buffer;
+		if (n > size_t(BlockSizeBytes)) {
+			largeBuffer.resize(n+16);
+			stream = largeBuffer.data();
+		}
+		memcpy(stream, in, n);
+		memset(stream+n, 0, 16);
+		uncompress(stream, out, outSize, entropy);
+	}
+};
+
+const uint32_t RansPimpl::RansL;
+
+Rans::Rans(Distribution::Type distType) : CODEC8withPimpl( new RansPimpl(distType) ) {}
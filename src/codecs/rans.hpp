@@ -0,0 +1,7 @@
+#pragma once
+#include <util/codec.hpp>
+#include <util/distribution.hpp>
+
+// Static rANS with 16 interleaved states. As in Rice and Marlin, the entropy byte of each block selects one of a 
+// set of prebuilt frequency tables, so packets carry no table.
+struct Rans : public CODEC8withPimpl { Rans(Distribution::Type distType = Distribution::Laplace); };
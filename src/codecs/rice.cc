@@ -5,6 +5,8 @@
 #include <cstring>
 #include <cmath>
 #include <iostream>
+#include <algorithm>
+#include <stdexcept>
 
 #define UNROLL1(c, sz_, a)  { typeof(sz_) sz = sz_; while(sz>c      + 0U) { sz-= 1; static const int fast = 1; (void)fast; a; }                               while(sz--) { static const int fast = 0; (void)fast; a; } }
 #define UNROLL4(c, sz_, a)  { typeof(sz_) sz = sz_; while(sz>c * 4U + 3U) { sz-= 4; static const int fast = 1; (void)fast; a;a;a;a; }                         while(sz--) { static const int fast = 0; (void)fast; a; } }
@@ -14,21 +16,20 @@
 //using namespace std;
 
 
-struct RicePimpl : public CODEC8Z {
+struct RicePimpl : public CODEC8Zstatic<RicePimpl> {
 
 	static const size_t SPLITS = 64;
 
+	// Interleaved blocks are coded as this many streams over consecutive parts of the block, decoded together.
+	// The payload starts with the number of symbols, which sets the stream boundaries, and the byte sizes of all
+	// streams but the last.
+	static const size_t Streams = 4;
+
 	Distribution::Type distType; // LAPLACE or EXPONENTIAL
+	bool interleaved;
 	
-	uint8_t  T[SPLITS][256]; // Transforms from Input space to Rice space (highest probability symbols first)
-	uint8_t iT[SPLITS][256]; // Transforms from Rice space (highest probability symbols first) to Input space
-	
-	uint32_t bestm[SPLITS];
-
-	int32_t cQ[SPLITS][256];
-	uint64_t cR[SPLITS][256];
-
-	static const int RICE_UTABLE_SIZE = 2*1024;
+	static const int RICE_UTABLE_BITS = 11;
+	static const int RICE_UTABLE_SIZE = 1<<RICE_UTABLE_BITS;
 	struct RiceUTable {
 		union {
 			uint64_t d64;
@@ -37,7 +38,23 @@ struct RicePimpl : public CODEC8Z {
 		uint32_t nData;
 		uint32_t bDisp;
 	};
-	RiceUTable uT[SPLITS][RICE_UTABLE_SIZE];
+
+	// Splits with the same parameter and symbol ranking share one set of tables, so that data of mixed 
+	// entropy touches a few tables instead of one per split.
+	struct Tables {
+		uint8_t  T[256]; // Transforms from Input space to Rice space (highest probability symbols first)
+		uint8_t iT[256]; // Transforms from Rice space (highest probability symbols first) to Input space
+		uint32_t m;
+		
+		int32_t  cQ[256];
+		uint32_t cR[256];
+
+		RiceUTable uT[RICE_UTABLE_SIZE];
+	};
+	std::vector<Tables> tables;
+	uint8_t tableOf[SPLITS];
+
+	const Tables &splitTables(uint8_t zeroCount) const { return tables[tableOf[zeroCount*SPLITS/256]]; }
 
 	static double efficiency(const std::array<double,256> &pdf, const uint8_t *T, int m) {
 
@@ -48,11 +65,10 @@ struct RicePimpl : public CODEC8Z {
 		return Distribution::entropy(pdf)/riceCost;
 	}
 
-	std::string name() const { return "Rice"; }
+	std::string name() const { return interleaved ? "Rice4X" : "Rice"; }
 
-	RicePimpl(Distribution::Type distType_) : distType(distType_) {
+	RicePimpl(Distribution::Type distType_, bool interleaved_) : distType(distType_), interleaved(interleaved_) {
 
-		memset(&uT, 0, sizeof(uT));
 		for (size_t split=0; split<SPLITS; split++) {
 			
 			double p = (split+0.5)/SPLITS;
@@ -61,42 +77,57 @@ struct RicePimpl : public CODEC8Z {
 			std::array<double,256> pdf = Distribution::pdf(distType, p);
 		
 			// Calculate PDF, sorted from most probable symbol to least probable symbol
+			uint8_t T[256], iT[256];
 			{
 				std::array<std::pair<double,uint8_t>,256> pdfSorted;
 				for (uint i=0;i<256;i++) pdfSorted[i] = {pdf[i],i};
 				std::sort(pdfSorted.begin(), pdfSorted.end());
 				std::reverse(pdfSorted.begin(), pdfSorted.end());
 				
-				for (uint i=0;i<256;i++)  T[split][pdfSorted[i].second] = i; 
-				for (uint i=0;i<256;i++) iT[split][i] = pdfSorted[i].second; 
+				for (uint i=0;i<256;i++)  T[pdfSorted[i].second] = i; 
+				for (uint i=0;i<256;i++) iT[i] = pdfSorted[i].second; 
 			}
 		
 			// Calculate best M parameter for compression
+			uint32_t bestm = 0;
 			double bestEfficiency = 0.;
 			for (int m=0; m<8; m++) {
-				double eff = efficiency( pdf, T[split], m);
+				double eff = efficiency( pdf, T, m);
 				if (eff>bestEfficiency) {
 					bestEfficiency=eff;
-					bestm[split]=m;
+					bestm=m;
 				}
 			}
 			
+			tableOf[split] = std::find_if(tables.begin(), tables.end(), [&](const Tables &t) {
+				return t.m == bestm and not memcmp(t.iT, iT, sizeof(iT)); 
+			}) - tables.begin();
+			if (tableOf[split] < tables.size())
+				continue;
+			
+			tables.emplace_back();
+			Tables &t = tables.back();
+			memset(&t, 0, sizeof(t));
+			memcpy(t.T, T, sizeof(T));
+			memcpy(t.iT, iT, sizeof(iT));
+			t.m = bestm;
+			
 			// Precalculate compression tables
 			for (uint in=0; in<256; in++) {
-				int m = bestm[split];
+				int m = t.m;
 				int M = 1<<m;
-				int rice = T [split][in];
-				cQ[split][in] = -(1+m+(rice>>m));
-				cR[split][in] = M|(rice&(M-1));
+				int rice = t.T[in];
+				t.cQ[in] = -(1+m+(rice>>m));
+				t.cR[in] = M|(rice&(M-1));
 			}
 
 			// Precalculate uncompression tables
 			for (int x=0; x<RICE_UTABLE_SIZE; x++) {
 		
-				uint m = bestm[split];
+				uint m = t.m;
 				uint M = 1<<m;
 					
-				RiceUTable &ut = uT[split][x];
+				RiceUTable &ut = t.uT[x];
 				uint bit = RICE_UTABLE_SIZE/2;
 				for (int d=0; d<8; d++) {
 					int q = 0;
@@ -104,7 +135,7 @@ struct RicePimpl : public CODEC8Z {
 					if (bit<M) break;
 					bit >>= 1+m;
 					if ((q<<m) + (x/(bit*2+!bit))%M > 255) break;
-					ut.d8[d] = iT[split][(q<<m) + (x/(bit*2+!bit))%M];
+					ut.d8[d] = t.iT[(q<<m) + (x/(bit*2+!bit))%M];
 					ut.nData ++;
 					ut.bDisp += 1+m+q;
 				}
@@ -112,45 +143,233 @@ struct RicePimpl : public CODEC8Z {
 		}
 	}
 
+	// Encodes n symbols into at most capacity bytes. Returns the encoded size, or capacity if it does not fit.
+	size_t compress(const uint8_t *i8, size_t n, uint8_t *out, size_t capacity, uint8_t zeroCount) const {
+
+		const Tables &t = splitTables(zeroCount);
+					
+		uint32_t *o32 = (uint32_t *)out;
+		uint32_t *o32end = o32 + capacity/4;
+
+		const int32_t  *Q = t.cQ;
+		const uint32_t *R = t.cR;
+
+		uint64_t st = 0;
+		int32_t sts = 64;
+
+		UNROLL16(0, n, {
+			
+			auto i = *i8++;
+			sts += Q[i];
+			
+			while (sts<0) {
+				if (o32==o32end) return capacity;
+				*o32++ = st>>32U; 
+				st <<= 32U;
+				sts += 32U;
+			}
+			st |= uint64_t(R[i])<<sts;
+		})
+		while (sts<64) {
+			
+			if (o32==o32end) return capacity;
+			*o32++ = st>>32U;
+			st <<= 32U;
+			sts += 32U;
+		}
+		
+		return (uint8_t *)o32-out;
+	}
+
+	size_t compressInterleaved(const uint8_t *in, size_t n, uint8_t *out, size_t capacity, uint8_t zeroCount) const {
+
+		size_t pos = 4*Streams;
+		if (pos >= capacity) return capacity;
+		
+		((uint32_t *)out)[0] = n;
+		for (size_t k=0; k<Streams; k++) {
+			
+			size_t begin = k*n/Streams, end = (k+1)*n/Streams;
+			size_t sz = compress(in+begin, end-begin, out+pos, capacity-pos, zeroCount);
+			if (sz == capacity-pos) return capacity;
+			
+			if (k+1<Streams) ((uint32_t *)out)[k+1] = sz;
+			pos += sz;
+		}
+		return pos;
+	}
+
 	void   compress(
 		const std::vector<std::reference_wrapper<const AlignedArray8>> &in,
 		      std::vector<std::reference_wrapper<      AlignedArray8>> &out,
 		      std::vector<std::reference_wrapper<      uint8_t      >> &zeroCounts) const { 
 			
-		for (size_t j=0; j<in.size(); j++) {
+		for (size_t j=0; j<in.size(); j++)
+			if (interleaved)
+				out[j].get().resize(compressInterleaved(in[j].get().data(), in[j].get().size(), out[j].get().begin(), out[j].get().capacity(), zeroCounts[j]));
+			else
+				out[j].get().resize(compress(in[j].get().data(), in[j].get().size(), out[j].get().begin(), out[j].get().capacity(), zeroCounts[j]));
+	}
 
-			int split = zeroCounts[j]*SPLITS/256;
-						
-			const uint8_t *i8 = in[j].get().begin();
-			uint32_t *o32 =(uint32_t *)out[j].get().begin();
+	size_t compressPacket(const uint8_t *in, size_t n, uint8_t *out, uint8_t &entropy) const {
 
-			const int32_t  *Q = cQ[split];
-			const uint64_t *R = cR[split];
+		return interleaved ? compressInterleaved(in, n, out, n, entropy) : compress(in, n, out, n, entropy);
+	}
+
+	// Bit reader for the interleaved decoder, over a stream of 32 bit words, most significant bit first. Unlike 
+	// the single stream decoder it keeps no bit buffer, so that four of them fit in registers.
+	struct Stream {
+		const uint32_t *i32;
+		uint8_t *o8;
+		size_t pos;
+
+		// At least the next 33 bits, reading at most one word past the one holding pos.
+		uint64_t peek() const { return ((uint64_t(i32[pos/32])<<32) | i32[pos/32+1]) << (pos%32); }
+	};
+
+	// Decodes a single symbol.
+	__attribute__((noinline)) void decodeSymbol(Stream &s, const Tables &t) const {
+
+		uint64_t st = s.peek();
+		uint q=0;
+		while (not (st>>32)) {
+			s.pos += 32;
+			q += 32;
+			st = s.peek();
+		}
 
-			uint64_t st = 0;
-			int32_t sts = 64;
+		uint leadZ = __builtin_clzll(st);
+		q += leadZ;
+		s.pos += leadZ+1;
 
-			UNROLL16(0, in[j].get().size(), {
+		uint m = t.m;
+		if (m) {
+			*s.o8++ = t.iT[(q<<m) + (s.peek()>>(64-m))];
+			s.pos += m;
+		} else {
+			*s.o8++ = t.iT[q];
+		}
+	}
+
+	// Decodes the symbols of one table entry if fast (storing 8 bytes), or a single symbol. Returns the number 
+	// of symbols decoded.
+	__attribute__((always_inline)) inline size_t decodeStep(Stream &s, const Tables &t, bool fast) const {
+
+		const RiceUTable &ut = t.uT[s.peek()>>(64-RICE_UTABLE_BITS)];
+		if (fast and ut.nData) {
+
+			*(uint64_t *)s.o8 = ut.d64;
+			s.o8  += ut.nData;
+			s.pos += ut.bDisp;
+			return ut.nData;
+		} 
+		
+		decodeSymbol(s, t);
+		return 1;
+	}
+
+	// Decodes n symbols. The stream is read at most one 32 bit word past its end, and the output is written 
+	// with 8 byte stores.
+	void uncompress(const uint32_t *i32, uint8_t *o8, size_t n, uint8_t zeroCount) const {
+
+		const Tables &t = splitTables(zeroCount);
+		
+		const RiceUTable *ut = t.uT;
+		uint uts = 64-RICE_UTABLE_BITS;
+			
+		uint m = t.m;
+		uint m64 = 64-m;
+		
+		uint64_t st = 0;
+		uint32_t sts = 64;
+		
+		UNROLL4(8, n, {
+			if (sts>=32U) {
 				
-				auto i = *i8++;
-				sts += Q[i];
+				uint64_t v = *i32++;
+				sts -= 32U;
+				st |= v << sts;
+			}
+
+			const RiceUTable &u = ut[st>>uts];
+			if (fast and u.nData) {
+
+				*(uint64_t *)o8 = u.d64;
+				o8  += u.nData;
+				st <<= u.bDisp;
+				sts += u.bDisp;
+				sz  -= u.nData-1;
+
+			} else {
 				
-				while (sts<0) {
-					*o32++ = st>>32U; 
+				uint q=0;
+				while (st<0x100000000ULL) {
+
+					uint64_t v = *i32++;
 					st <<= 32U;
-					sts += 32U;
+					q += 32U;
+					st |= v << sts;
+				}
+
+				uint leadZ = __builtin_clzll(st);
+				q += leadZ;
+				st <<= leadZ+1;
+				sts += leadZ+1;
+
+				if (m) {
+
+					if (sts>m64) {
+						uint64_t v = *i32++;
+						sts -= 32;
+						st |= v<<sts;
+					}
+
+					*o8++ = t.iT[(q<<m) + (st>>m64)];
+
+					st <<= m;
+					sts += m;
+				} else {
+					*o8++ = t.iT[q];
 				}
-				st |= R[i]<<sts;
-			})
-			while (sts<64) {
-				
-				*o32++ = st>>32U;
-				st <<= 32U;
-				sts += 32U;
 			}
+		})
+	}
+
+	// The streams are decoded in lockstep so that their dependency chains overlap. A stream takes the 8 byte 
+	// store path only while 8 symbols remain, so it never writes into the next one.
+	void uncompressInterleaved(const uint8_t *in, uint8_t *o8, size_t n, uint8_t zeroCount) const {
+
+		static_assert(Streams == 4, "the decoder keeps four streams in registers");
+
+		if (((const uint32_t *)in)[0] != n) throw std::runtime_error("Rice4X: corrupted block");
+
+		const Tables &t = splitTables(zeroCount);
+		const uint32_t *sizes = (const uint32_t *)in + 1;
+		const uint8_t *stream = in + 4*Streams;
+
+		Stream s0 = { (const uint32_t *)(stream                              ), o8      , 0 };
+		Stream s1 = { (const uint32_t *)(stream + sizes[0]                   ), o8 + n/4, 0 };
+		Stream s2 = { (const uint32_t *)(stream + sizes[0]+sizes[1]          ), o8 + n/2, 0 };
+		Stream s3 = { (const uint32_t *)(stream + sizes[0]+sizes[1]+sizes[2]), o8+3*n/4, 0 };
+		
+		// A step decodes at most 8 symbols, so all streams can take that many rounds of fast steps.
+		while (true) {
+			
+			size_t rounds = std::min(std::min(o8+n/4-s0.o8, o8+n/2-s1.o8), std::min(o8+3*n/4-s2.o8, o8+n-s3.o8))/8;
+			if (not rounds) break;
 			
-			out[j].get().resize((uint8_t *)o32-(uint8_t *)out[j].get().begin());
+			while (rounds--) {
+				decodeStep(s0, t, true);
+				decodeStep(s1, t, true);
+				decodeStep(s2, t, true);
+				decodeStep(s3, t, true);
+			}
 		}
+		
+		while (s0.o8 < o8+  n/4) decodeStep(s0, t, o8+  n/4-s0.o8 >= 8);
+		while (s1.o8 < o8+  n/2) decodeStep(s1, t, o8+  n/2-s1.o8 >= 8);
+		while (s2.o8 < o8+3*n/4) decodeStep(s2, t, o8+3*n/4-s2.o8 >= 8);
+		while (s3.o8 < o8+  n  ) decodeStep(s3, t, o8+  n  -s3.o8 >= 8);
 	}
 
 	void uncompress(
@@ -158,74 +377,67 @@ struct RicePimpl : public CODEC8Z {
 		      std::vector<std::reference_wrapper<      AlignedArray8>> &out,
 		      std::vector<std::reference_wrapper<const uint8_t      >> &zeroCounts) const {
 		
-		for (size_t j=0; j<out.size(); j++) {
-						
-			uint8_t *o8 = out[j].get().begin();
-			const uint32_t *i32 = (const uint32_t *)in[j].get().begin();
-			uint split = zeroCounts[j]*SPLITS/256;
-						
-			const RiceUTable *ut = uT[split];
-			uint uts = 64-std::round(std::log2(RICE_UTABLE_SIZE));
-				
-			uint m = bestm[split];
-			uint m64 = 64-m;
-			
-			uint64_t st = 0;
-			uint32_t sts = 64;
-			
-			UNROLL4(8, out[j].get().size(), {
-				if (sts>=32U) {
-					
-					uint64_t v = *i32++;
-					sts -= 32U;
-					st |= v << sts;
-				}
-
-				const RiceUTable &t = ut[st>>uts];
-				if (fast and t.nData) {
-
-					*(uint64_t *)o8 = t.d64;
-					o8  += t.nData;
-					st <<= t.bDisp;
-					sts += t.bDisp;
-					sz  -= t.nData-1;
+		for (size_t j=0; j<out.size(); j++)
+			if (interleaved)
+				uncompressInterleaved(in[j].get().begin(), out[j].get().begin(), out[j].get().size(), zeroCounts[j]);
+			else
+				uncompress((const uint32_t *)in[j].get().begin(), out[j].get().begin(), out[j].get().size(), zeroCounts[j]);
+	}
 
-				} else {
-					
-					uint q=0;
-					while (st<0x100000000ULL) {
+	void uncompressPacket(const uint8_t *in, size_t n, uint8_t *out, size_t outSize, uint8_t entropy) const {
 
-						uint64_t v = *i32++;
-						st <<= 32U;
-						q += 32U;
-						st |= v << sts;
-					}
+		// The decoder reads one word past the stream.
+		alignas(8) uint8_t buffer[BlockSizeBytes+8];
+		std::vector<uint64_t> largeBuffer;
+		uint8_t *stream = buffer;
+		if (n > size_t(BlockSizeBytes)) {
+			largeBuffer.resize(n/8+2);
+			stream = (uint8_t *)largeBuffer.data();
+		}
+		memcpy(stream, in, n);
+		memset(stream+n, 0, 8);
+		if (interleaved)
+			uncompressInterleaved(stream, out, outSize, entropy);
+		else
+			uncompress((const uint32_t *)stream, out, outSize, entropy);
+	}
 
-					uint leadZ = __builtin_clzll(st);
-					q += leadZ;
-					st <<= leadZ+1;
-					sts += leadZ+1;
+	// Bytes past n that a buffer holding the stream in its last compressedSize bytes needs to decode it in place:
+	// the stream is moved one word down for the read ahead, and every 8 byte store must stay below the first 
+	// word that is not fully consumed.
+	size_t inPlaceMargin(const uint32_t *i32, size_t compressedSize, size_t n, uint8_t zeroCount) const {
 
-					if (m) {
+		uint m = splitTables(zeroCount).m;
+		
+		int64_t worst = 0;
+		size_t bit = 0, bits = 8*compressedSize;
+		for (size_t k=0; k<n; k++) {
 
-						if (sts>m64) {
-							uint64_t v = *i32++;
-							sts -= 32;
-							st |= v<<sts;
-						}
+			worst = std::max(worst, int64_t(k + 8) - int64_t(4*(bit/32)));
+			while (bit<bits and not ((i32[bit/32] >> (31-bit%32)) & 1))
+				bit++;
+			bit += 1 + m;
+			if (bit>bits) return SIZE_MAX/2;
+		}
+		return std::max<int64_t>(0, worst + 4 + int64_t(compressedSize) - int64_t(n));
+	}
 
-						*o8++ = iT[split][(q<<m) + (st>>m64)];
+	// Interleaved blocks are not decoded in place.
+	size_t inPlaceMargin(const AlignedArray8 &in, size_t n, uint8_t entropy) const {
+		
+		return (interleaved or in.size()%4) ? SIZE_MAX/2 : inPlaceMargin((const uint32_t *)in.data(), in.size(), n, entropy);
+	}
 
-						st <<= m;
-						sts += m;
-					} else {
-						*o8++ = iT[split][q];
-					}
-				}
-			})
+	bool uncompressBlockInPlace(uint8_t *buffer, size_t capacity, size_t compressedSize, size_t n, uint8_t entropy) const {
 
-		}
+		const uint8_t *in = buffer + capacity - compressedSize;
+		if (interleaved or compressedSize%4 or compressedSize>capacity or n + inPlaceMargin((const uint32_t *)in, compressedSize, n, entropy) > capacity)
+			return false;
+		
+		memmove(buffer + capacity - compressedSize - 4, in, compressedSize);
+		uncompress((const uint32_t *)(buffer + capacity - compressedSize - 4), buffer, n, entropy);
+		return true;
 	}
 };
 
-Rice::Rice(Distribution::Type distType) : CODEC8withPimpl( new RicePimpl(distType) ) {}
+Rice::Rice(Distribution::Type distType, bool interleaved) : CODEC8withPimpl( new RicePimpl(distType, interleaved) ) {}
@@ -2,5 +2,7 @@
 #include <util/codec.hpp>
 #include <util/distribution.hpp>
 
-struct Rice : public CODEC8withPimpl { Rice(Distribution::Type distType = Distribution::Laplace); };
+// interleaved codes each block as 4 streams that are decoded together (Rice4X), which is faster to decode 
+// but not compatible with the single stream format.
+struct Rice : public CODEC8withPimpl { Rice(Distribution::Type distType = Distribution::Laplace, bool interleaved = false); };
 
@@ -7,13 +7,18 @@
 #include <stack>
 
 #include <memory>
+#include <mutex>
 #include <algorithm>
+#include <numeric>
+#include <cstring>
 
 #include <util/distribution.hpp>
 #include <cassert>
 
 class Marlin2018Simple {
 	
+	friend class Marlin2018Context;
+	
 	// Configuration
 	constexpr static const bool enableDedup = true;	
 	constexpr static const bool enableVictimDictionary = true;
@@ -72,7 +77,7 @@ class Marlin2018Simple {
 			size_t erased=0;
 		};
 
-		std::shared_ptr<Node> buildTree(std::vector<double> Pstates, bool isVictim) const {
+		std::shared_ptr<Node> buildTree(std::vector<double> Pstates, bool isVictim, bool enableVictimDict, size_t &depth) const {
 
 			std::vector<double> PN;
 			for (auto &&a : alphabet) PN.push_back(a.p);
@@ -91,8 +96,6 @@ class Marlin2018Simple {
 			std::priority_queue<std::shared_ptr<Node>, std::vector<std::shared_ptr<Node>>, decltype(cmp)> pq(cmp);
 			size_t retiredNodes=0;
 			
-			bool enableVictimDict = Marlin2018Simple::configuration("enableVictim", Marlin2018Simple::enableVictimDictionary);
-			
 			double ppThres = Marlin2018Simple::purgeProbabilityThreshold/(1U<<keySize);
 
 			// DICTIONARY INITIALIZATION
@@ -145,7 +148,14 @@ class Marlin2018Simple {
 					
 				std::shared_ptr<Node> node = pq.top();
 				pq.pop();
-				
+
+				// The root already has every child, it only holds the spot of the empty word. Growing it would read
+				// Pchild one past its end, the heap overflow ASan and TSan reported in dictionary construction.
+				if (node->size()>=alphabet.size()) {
+					retiredNodes++;
+					continue;
+				}
+
 				double p = node->p * Pchild[node->size()];
 				node->push_back(std::make_shared<Node>());
 				node->back()->p = p;
@@ -176,6 +186,7 @@ class Marlin2018Simple {
 					std::shared_ptr<Node> n = q.top();
 					q.pop();
 					n->p *= factor;
+					depth = std::max(depth, n->sz);
 					for (size_t i = 0; i<n->size(); i++)
 						q.emplace(n->at(i));
 				}
@@ -189,24 +200,33 @@ class Marlin2018Simple {
 		
 			std::vector<Word> ret;
 			
-			std::stack<std::pair<std::shared_ptr<Node>, Word>> q;
-			Word rootWord; rootWord.p = root->p;
-			q.emplace(root, rootWord);
-			while (not q.empty()) {
-				std::shared_ptr<Node> n = q.top().first;
-				Word w = q.top().second;
-				q.pop();
-				if (not n->erased) ret.push_back(w);
-				for (size_t i = 0; i<n->size(); i++) {
-					
-					Word w2 = w;
-					w2.push_back(alphabet[i].symbol);
-					w2.p = n->at(i)->p;
-					w2.state = n->at(i)->size();
-					
-					assert(n->at(i)->sz == w2.size());
-					q.emplace(n->at(i), w2);
+			// Depth first, children in reverse order. The current word is kept in a single buffer instead of
+			// copying it for every node.
+			Word word;
+			std::vector<std::pair<const Node *, size_t>> stack; // Node and number of children left to visit.
+			auto enter = [&](const Node *n) {
+				if (not n->erased) {
+					ret.push_back(word);
+					ret.back().p = n->p;
+					ret.back().state = (n==root.get()) ? 0 : n->size();
 				}
+				stack.emplace_back(n, n->size());
+			};
+			
+			enter(root.get());
+			while (not stack.empty()) {
+				
+				if (stack.back().second == 0) {
+					stack.pop_back();
+					if (not word.empty()) word.pop_back();
+					continue;
+				}
+				
+				size_t i = --stack.back().second;
+				const Node *child = stack.back().first->at(i).get();
+				word.push_back(alphabet[i].symbol);
+				assert(child->sz == word.size());
+				enter(child);
 			}
 			return ret;
 		}
@@ -285,6 +305,9 @@ class Marlin2018Simple {
 		const size_t keySize;     // Non overlapping bits of the word index in the big dictionary.
 		const size_t overlap;     // Bits that overlap between keys.s
 		const size_t maxWordSize; // Maximum number of symbols that a word in the dictionary can have.
+		
+		// Deepest node grown in any iteration. Any maxWordSize not below it builds this same dictionary.
+		size_t depth = 0;
 
 		double calcEfficiency() const {
 		
@@ -311,9 +334,15 @@ class Marlin2018Simple {
 			
 			int victimDictionary = 0;
 			
-			std::vector<std::shared_ptr<Node>> dictionaries;
+			// Sections are independent within an iteration, so they are built in parallel. The configuration map
+			// is not thread safe, so buildTree gets its values instead of reading them.
+			bool enableVictimDict = Marlin2018Simple::configuration("enableVictim", Marlin2018Simple::enableVictimDictionary);
+			
+			std::vector<std::shared_ptr<Node>> dictionaries(1<<overlap);
+			std::vector<size_t> depths(1<<overlap, 0);
+			#pragma omp parallel for
 			for (auto k=0; k<(1<<overlap); k++)
-				dictionaries.push_back(buildTree(Pstates[k], k==victimDictionary) );
+				dictionaries[k] = buildTree(Pstates[k], k==victimDictionary, enableVictimDict, depths[k]);
 				
 			*(std::vector<Word> *)this = arrangeAndFuse(dictionaries,victimDictionary);
 				
@@ -322,6 +351,9 @@ class Marlin2018Simple {
 			size_t iterations= Marlin2018Simple::configuration("iterations", Marlin2018Simple::iterationLimit);
 				
 			while (iterations--) {
+				
+				auto previousPstates = Pstates;
+				int previousVictim = victimDictionary;
 
 				// UPDATING STATE PROBABILITIES
 				{
@@ -346,9 +378,22 @@ class Marlin2018Simple {
 				}
 				if (Marlin2018Simple::configuration("debug", Marlin2018Simple::debug)) print(Pstates);
 
-				dictionaries.clear();
+				// Trees are a deterministic function of their state probabilities and victim flag. Sections whose
+				// inputs did not change keep their tree, and once no section changes the dictionary has converged.
+				// Changed sections are regrown from the root: a tree seeded from the previous one would be grown in
+				// a different order, and so give a different, not necessarily better, dictionary.
+				std::vector<bool> changed(1<<overlap);
 				for (auto k=0; k<(1<<overlap); k++)
-					dictionaries.push_back(buildTree(Pstates[k], k==victimDictionary) );
+					changed[k] = (Pstates[k] != previousPstates[k]) or 
+						((k==victimDictionary) != (k==previousVictim));
+				
+				if (std::find(changed.begin(), changed.end(), true) == changed.end())
+					break;
+
+				#pragma omp parallel for
+				for (auto k=0; k<(1<<overlap); k++)
+					if (changed[k])
+						dictionaries[k] = buildTree(Pstates[k], k==victimDictionary, enableVictimDict, depths[k]);
 				
 				*(std::vector<Word> *)this = arrangeAndFuse(dictionaries,victimDictionary);
 				
@@ -356,9 +401,104 @@ class Marlin2018Simple {
 				if (Marlin2018Simple::configuration("debug", Marlin2018Simple::debug)) printf("Efficiency: %3.4lf\n", calcEfficiency());		
 			}
 			if (Marlin2018Simple::configuration("debug", Marlin2018Simple::debug)) printf("Efficiency: %3.4lf\n", calcEfficiency());				
-		}			
+			
+			depth = *std::max_element(depths.begin(), depths.end());
+		}
+		
+		// Same dictionary under a different maxWordSize, only valid if it is not below depth.
+		Dictionary(const Dictionary &other, size_t maxWordSize_)
+			: std::vector<Word>(other), alphabet(other.alphabet), keySize(other.keySize), overlap(other.overlap), 
+			  maxWordSize(maxWordSize_), depth(other.depth) {
+			
+			if (depth > maxWordSize)
+				throw std::runtime_error ("maxWordSize below dictionary depth");
+		}
+	};
+	
+	// Alphabets larger than 256 symbols (e.g., 16 bit residuals). The 255 most probable values are mapped 
+	// to symbols, and the rest are coded with an escape symbol and stored verbatim aside the Marlin stream.
+	struct LargeAlphabet {
+		
+		constexpr static const Symbol Escape = 255;
+		
+		std::vector<Symbol> symbolOf; // Symbol coding each value, Escape if not coded.
+		std::vector<uint16_t> valueOf; // Value of each symbol. The escape decodes to a placeholder value that is never coded.
+		std::vector<double> pdf;       // Distribution of the symbols.
+		
+		LargeAlphabet() {}
+		LargeAlphabet(const std::vector<double> &pdf16) : symbolOf(pdf16.size(), Symbol(Escape)), valueOf(256), pdf(256, 0.) {
+			
+			if (pdf16.size() > 0x10000) 
+				throw std::runtime_error ("alphabet larger than 16 bits");
+			
+			std::vector<std::pair<double,size_t>> ranked;
+			for (size_t v=0; v<pdf16.size(); v++)
+				ranked.emplace_back(-pdf16[v], v);
+			std::stable_sort(ranked.begin(), ranked.end());
+			
+			for (size_t s=0; s<Escape; s++) {
+				symbolOf[ranked[s].second] = s;
+				valueOf[s] = ranked[s].second;
+				pdf[s] = -ranked[s].first;
+			}
+			valueOf[Escape] = ranked.back().second;
+			pdf[Escape] = std::max(1e-100, 1. - std::accumulate(pdf.begin(), pdf.end(), 0.));
+		}
+		
+		bool empty() const { return symbolOf.empty(); }
+	};
+	const LargeAlphabet largeAlphabet;
+	
+	// Immutable flat storage of the words of a Dictionary: the symbols of all words in a single buffer, 
+	// indexed by offsets. It is built once and shared by all the coders.
+	class WordArena {
+		
+		std::vector<uint32_t> offsets;
+		std::vector<Symbol> symbols;
+		
+	public:
+		
+		struct WordRef {
+			const Symbol *b, *e;
+			const Symbol *begin() const { return b; }
+			const Symbol *end() const { return e; }
+			size_t size() const { return e-b; }
+			bool empty() const { return b==e; }
+			Symbol back() const { return e[-1]; }
+			Symbol operator[](size_t i) const { return b[i]; }
+			bool operator==(const WordRef &rhs) const { return size()==rhs.size() and std::equal(b, e, rhs.b); }
+			operator Word() const { return Word(b, e); }
+		};
+
+		const size_t keySize;
+		const size_t overlap;
+		const size_t maxWordSize;
+		const size_t alphabetSize;
+		const double efficiency;
+		
+		WordArena(const Dictionary &dict) :
+			keySize(dict.keySize),
+			overlap(dict.overlap),
+			maxWordSize(dict.maxWordSize),
+			alphabetSize(dict.alphabet.size()),
+			efficiency(dict.calcEfficiency()) {
+			
+			size_t nSymbols = 0;
+			for (auto &&w : dict) nSymbols += w.size();
+
+			offsets.reserve(dict.size()+1);
+			symbols.reserve(nSymbols);
+			offsets.push_back(0);
+			for (auto &&w : dict) {
+				symbols.insert(symbols.end(), w.begin(), w.end());
+				offsets.push_back(symbols.size());
+			}
+		}
+		
+		size_t size() const { return offsets.size()-1; }
+		WordRef operator[](size_t i) const { return WordRef{symbols.data()+offsets[i], symbols.data()+offsets[i+1]}; }
 	};
-	const Dictionary dictionary;
+	const std::shared_ptr<const WordArena> words;
 	
 	struct Encoder { 
 
@@ -425,35 +565,50 @@ class Marlin2018Simple {
 				data = (*dv)();
 			}
 			
-			void clean(JumpIdx start, const Dictionary &dict) {
+			void clean(JumpIdx start, const std::vector<JumpIdx> &roots, const WordArena &dict) {
 				
 				size_t NumSections = 1<<dict.overlap;
 				size_t SectionSize = 1<<dict.keySize;
 			
-				// Deduplicate
+				// Deduplicate: sections identical to an earlier one are remapped to it in a single pass. Only sections 
+				// with the same hash are compared word by word.
 				if (true) {
+					std::vector<size_t> hashes(NumSections, 0);
+					for (size_t k=0; k<NumSections; k++)
+						for (size_t i=k*SectionSize; i<(k+1)*SectionSize; i++) {
+							hashes[k] = hashes[k]*1000003 + dict[i].size();
+							for (auto &&c : dict[i]) hashes[k] = hashes[k]*31 + c;
+						}
+					
+					std::vector<JumpIdx> sectionMap(NumSections);
+					bool remap = false;
 					for (size_t k=0; k<NumSections; k++) {
-						bool ok = false;
-						for (size_t k2=0; (not ok) and (k2<k); k2++) {
-							ok = true;
+						sectionMap[k] = k;
+						for (size_t k2=0; k2<k; k2++) {
+							if (hashes[k2]!=hashes[k]) continue;
+							bool ok = true;
 							for (size_t i=0; ok and (i<SectionSize); i++)
 								ok = (dict[k*SectionSize+i] == dict[k2*SectionSize+i]);
-								
-							if (true and ok) {
-								for (auto &v : table)
-									if (((v>>dict.keySize)&((1<<dict.overlap)-1)) == k)
-										v = ((v&(FLAG_NEXT_WORD + FLAG_INSERT_EMPTY_WORD)) | 
-											(k2<<dict.keySize) | 
-											(v&((1<<dict.keySize)-1)));
-							}
+							if (not ok) continue;
+							sectionMap[k] = k2;
+							remap = true;
+							break;
 						}
 					}
+					
+					const JumpIdx sectionMask = JumpIdx(NumSections-1)<<dict.keySize;
+					if (remap) 
+						for (auto &v : table)
+							if (v!=JumpIdx(-1) and not isIntermediate(v))
+								v = (v & ~sectionMask) | (sectionMap[(v & sectionMask)>>dict.keySize]<<dict.keySize);
 				}
 			
 				// Zero unreachable
 				if (true) {
 					std::vector<bool> reachable(1<<wordStride,false);
 					reachable[start&((1U<<wordStride)-1)] = true;
+					for (auto &&r : roots)
+						reachable[r&((1U<<wordStride)-1)] = true;
 					for (auto &&v : table) 
 						reachable[v&((1U<<wordStride)-1)] = true;
 					
@@ -463,22 +618,19 @@ class Marlin2018Simple {
 								(*this)(i,j) = -1;
 				}
 				
-				{
+				if (Marlin2018Simple::configuration("debug", Marlin2018Simple::debug)) {
 					size_t unreachable = 0;
 					for (auto &&v : table)
 						if (v==JumpIdx(-1)) unreachable++;
 						
 					std::cerr << table.size() << " " << unreachable << " " << (100.*unreachable)/table.size() << std::endl;
-				}
 
-				{
-					
 					size_t emptySections=0;
 					for (size_t k=0; k<NumSections; k++) {
 						bool empty = true;
-						for (size_t i=0; empty and (i<(1U<<SectionSize)); i++)
+						for (size_t i=0; empty and (i<SectionSize); i++)
 							for (size_t j=0; empty and j<(1U<<alphaStride); j++)
-								empty = ((*this)(k*NumSections+i,j) == JumpIdx(-1));
+								empty = ((*this)(k*SectionSize+i,j) == JumpIdx(-1));
 						
 						if (empty)
 							emptySections++;
@@ -494,55 +646,64 @@ class Marlin2018Simple {
 		
 		JumpIdx start;
 		std::vector<JumpIdx> emptyWords; //emptyWords are pointers to the victim dictionary.
-		const Dictionary dict;
+		std::vector<JumpIdx> roots; // Trie root of each section: its empty word, or an intermediate node.
+		size_t startSection; // Section of the first word, as seen by the decoder.
+		const size_t keySize;
 
-		Encoder(const Dictionary &dict_) :
-			jumpTable(dict_.keySize, dict_.overlap, dict_.alphabet.size()),
-			dict(dict_) { 
+		Encoder(const WordArena &dict) :
+			jumpTable(dict.keySize, dict.overlap, dict.alphabetSize),
+			keySize(dict.keySize) { 
 			
 			size_t NumSections = 1<<dict.overlap;
 			size_t SectionSize = 1<<dict.keySize;
-			std::vector<std::map<Word, size_t>> positions(NumSections);
-
-			// Init the mapping (to know where each word goes)
-			for (size_t k=0; k<NumSections; k++)
+			
+			// The jump table is the trie of each section. Words are linked by increasing length, so their prefixes 
+			// are already in place. Words with a prefix that is not a word are left out: the greedy encoder may only 
+			// stop on words. Repeated words resolve to their last position. Sections without an empty word get an 
+			// intermediate root, which only the optimal parse walks from.
+			std::vector<JumpIdx> emptyWord(NumSections, JumpIdx(-1)); // Position of the empty word of each section.
+			std::vector<std::vector<JumpIdx>> singleSymbol(NumSections); // Position of each single symbol word.
+			std::vector<std::vector<JumpIdx>> byLength(dict.maxWordSize+1);
+			roots.resize(NumSections);
+			for (size_t k=0; k<NumSections; k++) {
+				
+				for (auto &&l : byLength) l.clear();
 				for (size_t i=k*SectionSize; i<(k+1)*SectionSize; i++)
-					positions[k][dict[i]] = i;
+					byLength[dict[i].size()].push_back(i);
 
-			// Link each possible word to its continuation
-			for (size_t k=0; k<NumSections; k++) {
-				for (size_t i=k*SectionSize; i<(k+1)*SectionSize; i++) {
-					Word word = dict[i];
-					size_t wordIdx = i;
-//					std::cerr << "start " << k << " " << i << " " << dict.size() << " " << word << std::endl;
-					while (not word.empty()) {
-						auto lastSymbol = word.back();						
-						word.pop_back();
-						size_t parentIdx;
-						if (positions[k].count(word)) {
-							parentIdx = positions[k][word];
-						} else {
-							std::cerr << (i%SectionSize) << "SHOULD NEVER HAPPEN" << std::endl;
-							parentIdx = jumpTable.getNewPos();
-						}
-						jumpTable(parentIdx, lastSymbol) = wordIdx;
-						wordIdx = parentIdx;
+				for (auto &&i : byLength[0]) 
+					emptyWord[k] = i;
+				
+				JumpIdx root = roots[k] = emptyWord[k]!=JumpIdx(-1) ? emptyWord[k] : jumpTable.getNewPos();
+				for (size_t l=1; l<byLength.size(); l++) {
+					for (auto &&i : byLength[l]) {
+						auto &&word = dict[i];
+						JumpIdx parent = root;
+						for (size_t c=0; parent!=JumpIdx(-1) and c+1<word.size(); c++)
+							parent = jumpTable(parent, word[c]);
+						if (parent!=JumpIdx(-1))
+							jumpTable(parent, word.back()) = i;
 					}
 				}
+				
+				singleSymbol[k].resize(dict.alphabetSize, JumpIdx(-1));
+				for (size_t j=0; j<dict.alphabetSize; j++)
+					if (not jumpTable.isIntermediate(jumpTable(root, j)))
+						singleSymbol[k][j] = jumpTable(root, j);
 			}
-						
+
 			//Link between inner dictionaries
 			for (size_t k=0; k<NumSections; k++) {
 				for (size_t i=k*SectionSize; i<(k+1)*SectionSize; i++) {
-					for (size_t j=0; j<dict.alphabet.size(); j++) {
+					size_t next = i%(1<<dict.overlap);
+					for (size_t j=0; j<dict.alphabetSize; j++) {
 						if (jumpTable(i,j)==JumpIdx(-1)) {
-							if (positions[i%(1<<dict.overlap)].count(Word(1,Symbol(j)))) {
-								jumpTable(i, j) = positions[i%(1<<dict.overlap)][Word(1,Symbol(j))] +
+							if (singleSymbol[next][j]!=JumpIdx(-1)) {
+								jumpTable(i, j) = singleSymbol[next][j] +
 									FLAG_NEXT_WORD;
-							} else { 
-//								std::cerr << "k" << i << " " << j << std::endl;
-								jumpTable(i, j) = positions[i%(1<<dict.overlap)][Word()] +
-									FLAG_NEXT_WORD + 
+							} else if (emptyWord[next]!=JumpIdx(-1)) { // Otherwise left unlinked.
+								jumpTable(i, j) = emptyWord[next] +
+									FLAG_NEXT_WORD +
 									FLAG_INSERT_EMPTY_WORD;
 							}
 						}
@@ -550,23 +711,129 @@ class Marlin2018Simple {
 				}
 			}
 			
-			
 			// Fill list of empty words
 			emptyWords.resize(NumSections,JumpIdx(-1));
 			for (size_t k=0; k<NumSections; k++)
-				emptyWords[k] = positions[k][Word()];
+				emptyWords[k] = emptyWord[k]!=JumpIdx(-1) ? emptyWord[k] : 0;
 
 			// Get Starting Positions (not encoded)
 			size_t victim = 0;
 			while (not dict[victim].empty()) 
 				victim++;
 			victim = victim % (1<<dict.overlap);
+			startSection = victim;
 
 			start = victim*SectionSize;
 			while (not dict[start].empty()) 
 				start++;
 
-			jumpTable.clean(start, dict);
+			jumpTable.clean(start, roots, dict);
+		}
+		
+		// Optimal parse: instead of the longest match, picks the word sequence with the fewest keys by dynamic
+		// programming over (position, section). Words are found walking the jump table from the section roots, 
+		// and empty words switch sections in place. The stream is read by the same Decoder.
+		template<class TIN, typename TOUT, typename std::enable_if<sizeof(typename TIN::value_type)==1,int>::type = 0>		
+		void encodeOptimal(const TIN &in, TOUT &out) const {
+			
+			const size_t NumSections = emptyWords.size();
+			const JumpIdx keyMask = (1<<keySize)-1;
+			const uint8_t *i = (const uint8_t *)&in.front();
+			const size_t n = in.size();
+			
+			struct State {
+				uint32_t cost = uint32_t(-1);
+				uint32_t key = 0;
+				uint16_t len = 0;
+				uint8_t prev = 0;
+			};
+			std::vector<State> states((n+1)*NumSections);
+			auto at = [&](size_t pos, size_t section) -> State & { return states[pos*NumSections+section]; };
+			
+			auto relax = [&](size_t pos, size_t section, uint32_t cost, JumpIdx key, size_t len, size_t prev) {
+				State &st = at(pos, section);
+				if (cost >= st.cost) return false;
+				st.cost = cost; st.key = key; st.len = len; st.prev = prev;
+				return true;
+			};
+			
+			at(0, startSection).cost = 0;
+			for (size_t pos=0; pos<=n; pos++) {
+				
+				// Empty words do not consume symbols, relax them until no section improves.
+				for (bool changed=true; changed; ) {
+					changed = false;
+					for (size_t s=0; s<NumSections; s++) {
+						if (at(pos,s).cost==uint32_t(-1) or jumpTable.isIntermediate(roots[s])) continue;
+						JumpIdx key = roots[s] & keyMask;
+						changed |= relax(pos, key%NumSections, at(pos,s).cost+1, key, 0, s);
+					}
+				}
+				
+				for (size_t s=0; s<NumSections; s++) {
+					
+					if (at(pos,s).cost==uint32_t(-1)) continue;
+					
+					JumpIdx node = roots[s];
+					for (size_t len=1; pos+len<=n; len++) {
+						node = jumpTable(node, i[pos+len-1]);
+						if (node==JumpIdx(-1) or (node & FLAG_NEXT_WORD)) break;
+						if (jumpTable.isIntermediate(node)) continue;
+						JumpIdx key = node & keyMask;
+						relax(pos+len, key%NumSections, at(pos,s).cost+1, key, len, s);
+					}
+				}
+			}
+			
+			size_t section = 0;
+			for (size_t s=0; s<NumSections; s++)
+				if (at(n,s).cost < at(n,section).cost) 
+					section = s;
+			
+			// Some input can not be parsed from the section roots, the greedy encoder handles it.
+			if (at(n,section).cost==uint32_t(-1))
+				return encodeA(in, out);
+			
+			std::vector<JumpIdx> keys;
+			for (size_t pos=n; at(pos,section).cost; ) {
+				const State &st = at(pos,section);
+				keys.push_back(st.key);
+				pos -= st.len;
+				section = st.prev;
+			}
+			std::reverse(keys.begin(), keys.end());
+			
+			if (out.size() < 2*in.size()) out.resize(in.size());
+			
+			uint32_t *o = (uint32_t *)&*out.begin();
+			uint32_t *oend = o + out.size()/4;
+			
+			uint64_t value=0; int32_t bits=0;
+			JumpIdx j0 = start;
+			for (auto &&key : keys) {
+				value <<= keySize;
+				bits += keySize;
+				value += key;
+				j0 = key;
+				if (bits>=32) {
+					if (o==oend) return;
+					bits -= 32;
+					*o++ = value>>bits;
+				}
+			}
+			
+			while (bits>0) {
+				while (bits<32) {
+					j0 = emptyWords[j0 % emptyWords.size()];
+					value <<= keySize;
+					bits += keySize;
+					value += j0 & keyMask;
+				}
+				if (o==oend) return;
+				bits -= 32;
+				*o++ = value>>bits;
+			}
+			out.resize((uint8_t *)o-(uint8_t *)&out.front());
 		}
 		
 		template<class TIN, typename TOUT, typename std::enable_if<sizeof(typename TIN::value_type)==1,int>::type = 0>		
@@ -575,7 +842,7 @@ class Marlin2018Simple {
 			if (out.size() < 2*in.size()) out.resize(in.size());
 			
 			uint32_t *o = (uint32_t *)&*out.begin();
-			uint32_t *oend = (uint32_t *)&*out.end();
+			uint32_t *oend = o + out.size()/4;
 			const uint8_t *i = (const uint8_t *)&in.front();
 			const uint8_t *iend = i + in.size();
 			
@@ -584,16 +851,19 @@ class Marlin2018Simple {
 			uint64_t value=0; int32_t bits=0;
 			if (i<iend) {
 				
-				JumpIdx j0 = jumpTable(start, *i++);
+				// Starting from the start word itself, a first symbol that leaves its trie emits the (empty) start 
+				// word like any other, instead of losing the symbol.
+				JumpIdx j0 = start;
 				while (i<iend) {
 
 
 					JumpIdx j1 = jumpTable(j0, *i++);
+					if (j1==JumpIdx(-1)) return; // No word continues here: the block is left uncompressed.
 					
 					if (j1 & FLAG_NEXT_WORD) {
-						value <<= dict.keySize;
-						bits += dict.keySize;
-						value += j0 & ((1<<dict.keySize)-1);
+						value <<= keySize;
+						bits += keySize;
+						value += j0 & ((1<<keySize)-1);
 						if (bits>=32) {
 							if (o==oend) return;
 							bits -= 32;
@@ -608,20 +878,20 @@ class Marlin2018Simple {
 					j0=j1;
 				}
 				assert (not jumpTable.isIntermediate(j0)); //If we end in an intermediate node, we should roll back. Not implemented.
-				value <<= dict.keySize;
-				bits += dict.keySize;
-				value += j0 & ((1<<dict.keySize)-1);
+				value <<= keySize;
+				bits += keySize;
+				value += j0 & ((1<<keySize)-1);
 
-//std::cerr << (j0 & ((1<<dict.keySize)-1)) << " " << bits << std::endl;
+//std::cerr << (j0 & ((1<<keySize)-1)) << " " << bits << std::endl;
 				
 				while (bits>0) {
 					while (bits<32) {
 						j0 = emptyWords[j0 % emptyWords.size()];
-						value <<= dict.keySize;
-						bits += dict.keySize;
-						value += j0 & ((1<<dict.keySize)-1);
+						value <<= keySize;
+						bits += keySize;
+						value += j0 & ((1<<keySize)-1);
 
-//std::cerr << (j0 & ((1<<dict.keySize)-1)) << " " << bits << std::endl;
+//std::cerr << (j0 & ((1<<keySize)-1)) << " " << bits << std::endl;
 					}
 					if (o==oend) return;
 					bits -= 32;
@@ -634,19 +904,21 @@ class Marlin2018Simple {
 
 		template<class TIN, typename TOUT, typename std::enable_if<sizeof(typename TIN::value_type)==1,int>::type = 0>		
 		void operator()(const TIN &in, TOUT &out) const {
-			if (dict.keySize==12) 
+			if (keySize==12) 
 				encodeA(in,out);
 			else
 				encodeA(in,out);
 		}
 	};
-	const Encoder encoderFast = Encoder(dictionary);
+	const Encoder encoderFast = Encoder(*words);
 	
+	// Slow coders only reference the shared words, and are built on demand.
 	struct EncoderSlow {
 		
-		const Dictionary W;
+		const std::shared_ptr<const WordArena> words;
+		const WordArena &W;
 		
-		EncoderSlow(const Dictionary &dict) : W(dict) {}
+		EncoderSlow(const std::shared_ptr<const WordArena> &words_) : words(words_), W(*words) {}
 		
 		template<typename T, typename IT>
 		static bool areEqual(const T &obj, const IT it) {
@@ -723,7 +995,6 @@ class Marlin2018Simple {
 //			std::cerr << "E: " << in.size() << " " << out.size() << std::endl;
 		}
 	};
-	const EncoderSlow encoderSlow = EncoderSlow(dictionary);
 
 	struct Decoder {
 
@@ -735,7 +1006,52 @@ class Marlin2018Simple {
 		
 		std::shared_ptr<DedupVector<Symbol>> dedupVector;
 		
+		// Dictionaries with words longer than 15 symbols use a two level table: entries are 8 or 16 bytes, short
+		// words are stored inline, and long words are marked and store the offset and length of their copy in 
+		// longWords. The hot table stays small regardless of maxWordSize.
+		constexpr static const uint8_t LongWord = 0xFF;
+		size_t entrySize = 0;
+		std::vector<Symbol> longWords;
+
 		std::vector<Symbol> decoderTable;
+		
+		template<size_t N, typename TIN, typename TOUT>
+		void decodeTwoLevel(const TIN &in, TOUT &out) const  {
+			
+			uint8_t *o = (uint8_t *)&out.front();
+			const uint32_t *i = (const uint32_t *)in.data();
+			const uint32_t *iend = (const uint32_t *)&*in.end();
+	
+			uint64_t mask = (1<<(keySize+overlap))-1;
+			const uint8_t *D = dedupVector ? (const uint8_t *)(*dedupVector)() : decoderTable.data();
+			uint64_t v32 = start; int32_t c=-keySize;
+			
+			while (c>=0 or i<iend) {
+				
+				if (c<0) {
+					v32 = (v32<<32) + *i++;
+					c   += 32;
+				}
+				const uint8_t *v = D + ((v32>>c) & mask)*N*8;
+				c -= keySize;
+				
+				if (__builtin_expect(v[N*8-1] == LongWord, 0)) {
+					uint32_t offset; uint16_t len;
+					memcpy(&offset, v, sizeof(offset));
+					memcpy(&len, v+4, sizeof(len));
+					const uint8_t *w = &longWords[offset];
+					memcpy(o, w, 64);
+					for (size_t n=64; n<len; n+=8)
+						memcpy(o+n, w+n, 8);
+					o += len;
+				} else {
+					memcpy(o, v, N*8);
+					o += v[N*8-1];
+				}
+			}
+			out.resize(o-(uint8_t *)&out.front());	
+		}
+		
 		template<typename T, size_t N, typename TIN, typename TOUT>
 		void decodeA(const TIN &in, TOUT &out) const  {
 			
@@ -902,7 +1218,7 @@ class Marlin2018Simple {
 			out.resize(o-(uint8_t *)&out.front());
 		}
 		
-		Decoder(const Dictionary &dict) :
+		Decoder(const WordArena &dict) :
 			keySize(dict.keySize),
 			overlap(dict.overlap),
 			maxWordSize(dict.maxWordSize) {
@@ -910,6 +1226,39 @@ class Marlin2018Simple {
 			start = 0;
 			while (not dict[start].empty()) 
 				start++;
+			
+			if (maxWordSize>15) {
+				
+				// 16 byte entries unless words longer than 7 symbols are rare.
+				size_t nLong = 0;
+				for (size_t i=0; i<dict.size(); i++)
+					if (dict[i].size()>7) nLong++;
+				entrySize = (nLong*8 > dict.size()) ? 16 : 8;
+				
+				decoderTable.resize(dict.size()*entrySize);
+				for (size_t i=0; i<dict.size(); i++) {
+
+					Symbol *d = &decoderTable[i*entrySize];
+					if (dict[i].size()<entrySize) {
+						d[entrySize-1] = dict[i].size();
+						for (auto c : dict[i])
+							*d++ = c;
+					} else {
+						// Long words are copied 8 bytes at a time, and at least 64 bytes.
+						uint32_t offset = longWords.size(); uint16_t len = dict[i].size();
+						memcpy(d, &offset, sizeof(offset));
+						memcpy(d+4, &len, sizeof(len));
+						d[entrySize-1] = LongWord;
+						longWords.insert(longWords.end(), dict[i].begin(), dict[i].end());
+						longWords.resize((longWords.size()+7) & ~size_t(7));
+					}
+				}
+				longWords.resize(longWords.size()+64);
+				
+				if (configuration("dedup", enableDedup))
+					dedupVector = std::make_shared<DedupVector<Symbol>>(decoderTable);
+				return;
+			}
 				
 			decoderTable.resize(dict.size()*(maxWordSize+1));
 			for (size_t i=0; i<dict.size(); i++) {
@@ -931,6 +1280,9 @@ class Marlin2018Simple {
 		template<typename TIN, typename TOUT>
 		void operator()(const TIN &in, TOUT &out) const {
 			
+			if (entrySize==8 ) return decodeTwoLevel<1>(in, out);
+			if (entrySize==16) return decodeTwoLevel<2>(in, out);
+			
 			if (keySize==12) {
 				switch (maxWordSize+1) {
 					case   4: return decode12<uint32_t>(in, out);
@@ -947,21 +1299,379 @@ class Marlin2018Simple {
 				case   4: return decodeA<uint32_t, 1>(in, out);
 				case   8: return decodeA<uint64_t, 1>(in, out);
 				case  16: return decodeA<uint64_t, 2>(in, out);
-				case  32: return decodeA<uint64_t, 4>(in, out);
-				case  64: return decodeA<uint64_t, 8>(in, out);
-				case 128: return decodeA<uint64_t,16>(in, out);
-				case 256: return decodeA<uint64_t,32>(in, out);
-				case 512: return decodeA<uint64_t,64>(in, out);
 				default: throw std::runtime_error ("unsupported maxWordSize");
 			}
 		}
+		
+		// Decodes only the first limit symbols. Reading stops at the word that reaches the limit, which is cut,
+		// and nothing is written beyond it, so out needs no padding.
+		template<typename TIN, typename TOUT>
+		void prefix(const TIN &in, TOUT &out, size_t limit) const {
+			
+			out.resize(limit);
+			uint8_t *o = (uint8_t *)&out.front();
+			uint8_t *oend = o + limit;
+			const uint32_t *i = (const uint32_t *)in.data();
+			const uint32_t *iend = (const uint32_t *)&*in.end();
+			
+			const size_t E = entrySize ? entrySize : maxWordSize+1;
+			const uint8_t *D = dedupVector ? (const uint8_t *)(*dedupVector)() : decoderTable.data();
+			
+			uint64_t mask = (1<<(keySize+overlap))-1;
+			uint64_t v32 = start; int32_t c=-keySize;
+			
+			while (o<oend and (c>=0 or i<iend)) {
+				
+				if (c<0) {
+					v32 = (v32<<32) + *i++;
+					c   += 32;
+				}
+				const uint8_t *v = &D[E*((v32>>c) & mask)];
+				c -= keySize;
+				
+				const uint8_t *w = v;
+				size_t len = v[E-1];
+				if (entrySize and len==LongWord) {
+					uint32_t offset; uint16_t longLen;
+					memcpy(&offset, v, sizeof(offset));
+					memcpy(&longLen, v+4, sizeof(longLen));
+					w = &longWords[offset];
+					len = longLen;
+				}
+				len = std::min(len, size_t(oend-o));
+				memcpy(o, w, len);
+				o += len;
+			}
+			out.resize(o-(uint8_t *)&out.front());
+		}
+
+		// Walks the codewords without decoding them. Returns the decoded size and, in margin, how many bytes the
+		// output buffer must extend past it for the stream to be decoded in place from the end of the buffer:
+		// every store (up to a whole table entry, or the 8 byte copies of a long word) must stay below the first
+		// input word that is not fully consumed.
+		template<typename TIN>
+		size_t inPlace(const TIN &in, size_t &margin) const {
+
+			const uint32_t *i = (const uint32_t *)in.data();
+			const uint32_t *iend = (const uint32_t *)&*in.end();
+
+			const size_t E = entrySize ? entrySize : maxWordSize+1;
+			const uint8_t *D = dedupVector ? (const uint8_t *)(*dedupVector)() : decoderTable.data();
+
+			uint64_t mask = (1<<(keySize+overlap))-1;
+			uint64_t v32 = start; int32_t c=-keySize;
+
+			int64_t o = 0, worst = 0;
+			while (c>=0 or i<iend) {
+
+				if (c<0) {
+					v32 = (v32<<32) + *i++;
+					c   += 32;
+				}
+				const uint8_t *v = &D[E*((v32>>c) & mask)];
+				c -= keySize;
+
+				int64_t len = v[E-1], store = E;
+				if (entrySize and len==LongWord) {
+					uint16_t longLen;
+					memcpy(&longLen, v+4, sizeof(longLen));
+					len = longLen;
+					store = std::max<int64_t>(64, (len+7)&~7);
+				}
+				// The c+keySize bits left in v32 have not been used yet, nor have the words holding them.
+				int64_t consumed = 4*(i-(const uint32_t *)in.data()) - 4*int64_t((c+keySize+31)/32);
+				worst = std::max(worst, o + store - consumed);
+				o += len;
+			}
+			margin = std::max<int64_t>(0, worst + int64_t(in.size()) - o);
+			return o;
+		}
+	};
+	const Decoder decoderFast = Decoder(*words);
+
+	// Non owning view over a caller buffer, for the raw buffer and in place entry points.
+	template<typename T>
+	struct Span {
+		typedef uint8_t value_type;
+		T *b; size_t n;
+		T *data() const { return b; }
+		T *begin() const { return b; }
+		T *end() const { return b+n; }
+		size_t size() const { return n; }
+		T &front() const { return *b; }
+		void resize(size_t n_) { n = n_; }
+	};
+	
+public:
+	// Aggregates of a compressed block, computed from its codewords without decoding it.
+	struct Statistics {
+		size_t symbols = 0;            // Decoded size.
+		size_t zeros = 0;
+		uint64_t sum = 0;              // Symbols as unsigned bytes.
+		int64_t signedSum = 0;         // Symbols as int8 residuals.
+		std::vector<size_t> histogram; // Only filled on request.
+	};
+	
+private:
+	// Reads the bitstream like Decoder, but each codeword adds its precomputed aggregates instead of copying 
+	// its word. Lengths and zero counts share a 64 bit add, as do sums and negative counts (32 bit lanes).
+	struct Scanner {
+		
+		const size_t keySize;
+		const size_t overlap;
+		size_t start;
+		
+		struct Entry { uint64_t lengthAndZeros, sumAndNegatives; };
+		std::vector<Entry> entries;
+		const WordArena &dict;
+		
+		template<bool Histogram, typename TIN>
+		void scanA(const TIN &in, Statistics &stats, uint32_t *counts) const {
+			
+			const uint32_t *i = (const uint32_t *)in.data();
+			const uint32_t *iend = (const uint32_t *)&*in.end();
+			
+			uint64_t mask = (1<<(keySize+overlap))-1;
+			const Entry *E = entries.data();
+			
+			uint64_t lz = 0, sn = 0;
+			auto add = [&](size_t idx) {
+				lz += E[idx].lengthAndZeros;
+				sn += E[idx].sumAndNegatives;
+				if (Histogram) counts[idx]++;
+			};
+			auto flush = [&]() {
+				stats.symbols += lz & 0xFFFFFFFF; stats.zeros += lz>>32;
+				stats.sum += sn & 0xFFFFFFFF; stats.signedSum -= 256*int64_t(sn>>32);
+				lz = sn = 0;
+			};
+			
+			// A word adds at most 511*255 to a lane, flushing every 8192 words keeps the lanes from overflowing.
+			uint64_t value = start;
+			if (keySize==12) {
+				for (size_t n=1; i+3<=iend; n++) {
+					value = (value<<32) + *i++;
+					add((value>>20) & mask);
+					add((value>> 8) & mask);
+					value = (value<<32) + *i++;
+					add((value>>28) & mask);
+					add((value>>16) & mask);
+					add((value>> 4) & mask);
+					value = (value<<32) + *i++;
+					add((value>>24) & mask);
+					add((value>>12) & mask);
+					add((value>> 0) & mask);
+					if (n%1024 == 0) flush();
+				}
+				flush();
+			}
+			
+			int32_t c=-keySize;
+			for (size_t n=1; c>=0 or i<iend; n++) {
+				if (c<0) {
+					value = (value<<32) + *i++;
+					c   += 32;
+				}
+				add((value>>c) & mask);
+				c -= keySize;
+				if (n%8192 == 0) flush();
+			}
+			flush();
+			stats.signedSum += stats.sum;
+		}
+		
+		Scanner(const WordArena &dict_) :
+			keySize(dict_.keySize),
+			overlap(dict_.overlap),
+			dict(dict_) {
+			
+			start = 0;
+			while (not dict[start].empty()) 
+				start++;
+			
+			entries.resize(dict.size());
+			for (size_t i=0; i<dict.size(); i++) {
+				uint64_t zeros = 0, sum = 0, negatives = 0;
+				for (auto &&c : dict[i]) {
+					zeros += (c==0);
+					sum += c;
+					negatives += (c>=128);
+				}
+				entries[i].lengthAndZeros = dict[i].size() + (zeros<<32);
+				entries[i].sumAndNegatives = sum + (negatives<<32);
+			}
+		}
+		
+		template<typename TIN>
+		Statistics operator()(const TIN &in, bool withHistogram) const {
+			
+			Statistics stats;
+			if (not withHistogram) {
+				scanA<false>(in, stats, nullptr);
+				return stats;
+			}
+			
+			std::vector<uint32_t> counts(dict.size());
+			scanA<true>(in, stats, counts.data());
+			stats.histogram.resize(256);
+			for (size_t w=0; w<counts.size(); w++)
+				if (counts[w])
+					for (auto &&s : dict[w])
+						stats.histogram[s] += counts[w];
+			return stats;
+		}
+	};
+	// Only dictionaries that are scanned pay for the aggregate table, built on the first scan.
+	mutable std::once_flag scannerBuilt;
+	mutable std::unique_ptr<const Scanner> scanner;
+
+	// Decodes 16 bit values of a LargeAlphabet. Each table entry holds maxWordSize values plus the word length.
+	// Encoded layout: uint32 number of escapes, the escaped values (padded to 4 bytes), and the Marlin stream.
+	struct Decoder16 {
+
+		const size_t keySize;
+		const size_t overlap;
+		const size_t maxWordSize;
+		const uint16_t placeholder;
+		
+		size_t start;
+		
+		// As in Decoder, long words use a two level table. Entries are 16 bytes: up to 7 values inline and
+		// the length. Long words are marked, and store their offset and length in the first values.
+		constexpr static const uint16_t LongWord = 0xFFFF;
+		const bool twoLevel;
+		std::vector<uint16_t> longWords;
+		
+		std::vector<uint16_t> decoderTable;
+		
+		uint16_t *decodeTwoLevel(const uint32_t *i, const uint32_t *iend, uint16_t *o) const  {
+			
+			uint64_t mask = (1<<(keySize+overlap))-1;
+			const uint16_t *D = decoderTable.data();
+			uint64_t v32 = start; int32_t c=-keySize;
+			
+			while (c>=0 or i<iend) {
+				
+				if (c<0) {
+					v32 = (v32<<32) + *i++;
+					c   += 32;
+				}
+				const uint16_t *v = D + ((v32>>c) & mask)*8;
+				c -= keySize;
+				if (__builtin_expect(v[7] == LongWord, 0)) {
+					uint32_t offset;
+					memcpy(&offset, v, sizeof(offset));
+					memcpy(o, &longWords[offset], 2*v[2]);
+					o += v[2];
+				} else {
+					memcpy(o, v, 16);
+					o += v[7];
+				}
+			}
+			return o;
+		}
+		
+		template<typename T, size_t N>
+		uint16_t *decodeA(const uint32_t *i, const uint32_t *iend, uint16_t *o) const  {
+			
+			uint64_t mask = (1<<(keySize+overlap))-1;
+			const size_t entry = N*sizeof(T)/sizeof(uint16_t);
+			const uint16_t *D = decoderTable.data();
+			uint64_t v32 = start; int32_t c=-keySize;
+			
+			while (c>=0 or i<iend) {
+				
+				if (c<0) {
+					v32 = (v32<<32) + *i++;
+					c   += 32;
+				}
+				const uint16_t *v = D + ((v32>>c) & mask)*entry;
+				c -= keySize;
+				memcpy(o, v, N*sizeof(T));
+				o += v[entry-1];
+			}
+			return o;
+		}
+		
+		Decoder16(const WordArena &dict, const LargeAlphabet &alphabet) :
+			keySize(dict.keySize),
+			overlap(dict.overlap),
+			maxWordSize(dict.maxWordSize),
+			placeholder(alphabet.valueOf[LargeAlphabet::Escape]),
+			twoLevel(maxWordSize>7) {
+				
+			start = 0;
+			while (not dict[start].empty()) 
+				start++;
+			
+			if (twoLevel) {
+				
+				decoderTable.resize(dict.size()*8);
+				for (size_t i=0; i<dict.size(); i++) {
+
+					uint16_t *d = &decoderTable[i*8];
+					if (dict[i].size()>7) {
+						uint32_t offset = longWords.size();
+						memcpy(d, &offset, sizeof(offset));
+						d[2] = dict[i].size();
+						d[7] = LongWord;
+						for (auto c : dict[i])
+							longWords.push_back(alphabet.valueOf[c]);
+					} else {
+						d[7] = dict[i].size();
+						for (auto c : dict[i])
+							*d++ = alphabet.valueOf[c];
+					}
+				}
+				return;
+			}
+				
+			decoderTable.resize(dict.size()*(maxWordSize+1));
+			for (size_t i=0; i<dict.size(); i++) {
+
+				uint16_t *d = &decoderTable[i*(maxWordSize+1)];
+				d[maxWordSize] = dict[i].size();
+				for (auto c : dict[i])
+					*d++ = alphabet.valueOf[c];
+			}
+		}
+		
+		template<typename TIN, typename TOUT>
+		void operator()(const TIN &in, TOUT &out) const {
+			
+			const uint8_t *p = (const uint8_t *)&*in.begin();
+			uint32_t nEscapes = *(const uint32_t *)p;
+			const uint16_t *escapes = (const uint16_t *)(p + 4);
+			const uint32_t *i = (const uint32_t *)(p + 4 + ((2*nEscapes+3) & ~3U));
+			const uint32_t *iend = (const uint32_t *)(p + in.size());
+			
+			uint16_t *o = (uint16_t *)&out.front(), *o0 = o;
+			if (twoLevel) 
+				o = decodeTwoLevel(i, iend, o);
+			else switch (maxWordSize+1) {
+				case   4: o = decodeA<uint64_t, 1>(i, iend, o); break;
+				case   8: o = decodeA<uint64_t, 2>(i, iend, o); break;
+				default: throw std::runtime_error ("unsupported maxWordSize");
+			}
+			out.resize(o-o0);
+			
+			// Escaped values are rare, patch them in a second pass.
+			for (uint16_t *v = o0; nEscapes and v<o; v++) {
+				if (*v == placeholder) {
+					*v = *escapes++;
+					nEscapes--;
+				}
+			}
+		}
 	};
-	const Decoder decoderFast = Decoder(dictionary);
+	std::shared_ptr<const Decoder16> decoder16;
 
 	struct DecoderSlow {
 		
-		const Dictionary W;
-		DecoderSlow(const Dictionary &dict) : W(dict) {}
+		const std::shared_ptr<const WordArena> words;
+		const WordArena &W;
+		
+		DecoderSlow(const std::shared_ptr<const WordArena> &words_) : words(words_), W(*words) {}
 			
 		template<typename TIN, typename TOUT>
 		void operator()(const TIN &in, TOUT &out) const  {
@@ -996,7 +1706,6 @@ class Marlin2018Simple {
 		}
 		
 	};	
-	const DecoderSlow decoderSlow = DecoderSlow(dictionary);
 	
 	static std::map<std::string, double> &getConfigurationStructure() {
 		static std::map<std::string, double> c;
@@ -1027,7 +1736,7 @@ public:
 	}
 	
 	static double theoreticalEfficiency(const std::vector<double> &pdf, size_t keySize=12, size_t overlap=0, size_t maxWordSize = 1<<20) {
-		Dictionary dictionary(pdf, keySize, overlap, maxWordSize);
+		Dictionary dictionary(pdf.size()>256 ? LargeAlphabet(pdf).pdf : pdf, keySize, overlap, maxWordSize);
 		return dictionary.calcEfficiency();
 	}
 
@@ -1042,14 +1751,74 @@ public:
 		return std::make_pair(efficiency, uniqueCount);
 	}
 	
+	// Builds the coder with the shortest maxWordSize (2^n-1, from 3 to 511) such that doubling it gains less
+	// than minGain efficiency. The largest dictionary is built first, caps not below its depth yield that same
+	// dictionary and are neither built for the search nor for the winner.
+	static std::shared_ptr<Marlin2018Simple> withBestWordSize(const std::vector<double> &pdf, size_t keySize, size_t overlap, double minGain = 0.005) {
+		
+		LargeAlphabet largeAlphabet(pdf.size()>256 ? LargeAlphabet(pdf) : LargeAlphabet());
+		const std::vector<double> &P = largeAlphabet.empty() ? pdf : largeAlphabet.pdf;
+		
+		// Only caps at or above the depth of the largest dictionary reuse it. Below it, a cap retires the nodes
+		// that reach it and gives their slots to other nodes, so the tree grows differently and is built anew.
+		Dictionary largest(P, keySize, overlap, 511);
+		double largestEfficiency = largest.calcEfficiency();
+		
+		size_t bestWordSize = 3;
+		double bestEfficiency = largestEfficiency;
+		std::shared_ptr<const Dictionary> best;
+		if (bestWordSize < largest.depth) {
+			best = std::make_shared<const Dictionary>(P, keySize, overlap, bestWordSize);
+			bestEfficiency = best->calcEfficiency();
+		}
+		
+		for (size_t maxWordSize=7; maxWordSize<=511; maxWordSize=2*maxWordSize+1) {
+			
+			std::shared_ptr<const Dictionary> dict;
+			double efficiency = largestEfficiency;
+			if (maxWordSize < largest.depth) {
+				dict = std::make_shared<const Dictionary>(P, keySize, overlap, maxWordSize);
+				efficiency = dict->calcEfficiency();
+			}
+			
+			if (bestEfficiency+minGain > efficiency) 
+				break;
+				
+			best = dict;
+			bestEfficiency = efficiency;
+			bestWordSize = maxWordSize;
+		}
+		
+		if (not best)
+			best = std::make_shared<const Dictionary>(largest, bestWordSize);
+			
+		return std::shared_ptr<Marlin2018Simple>(new Marlin2018Simple(std::move(largeAlphabet), *best));
+	}
+	
 	const double efficiency;
 
 	Marlin2018Simple (const std::vector<double> &pdf, size_t keySize, size_t overlap, size_t maxWordSize)
 		: 
-		  dictionary(pdf, keySize, overlap, maxWordSize),
-		  efficiency(dictionary.calcEfficiency())  {
+		  largeAlphabet(pdf.size()>256 ? LargeAlphabet(pdf) : LargeAlphabet()),
+		  words(std::make_shared<const WordArena>(Dictionary(largeAlphabet.empty() ? pdf : largeAlphabet.pdf, keySize, overlap, maxWordSize))),
+		  efficiency(words->efficiency)  {
+
+		if (not largeAlphabet.empty())
+			decoder16 = std::make_shared<Decoder16>(*words, largeAlphabet);
 	}
 
+private:
+	Marlin2018Simple (LargeAlphabet &&largeAlphabet_, const Dictionary &dictionary)
+		: 
+		  largeAlphabet(std::move(largeAlphabet_)),
+		  words(std::make_shared<const WordArena>(dictionary)),
+		  efficiency(words->efficiency)  {
+
+		if (not largeAlphabet.empty())
+			decoder16 = std::make_shared<Decoder16>(*words, largeAlphabet);
+	}
+	
+public:
     Marlin2018Simple() = delete;
     Marlin2018Simple(const Marlin2018Simple& other) = delete;
     Marlin2018Simple& operator= (const Marlin2018Simple& other) = delete;
@@ -1146,19 +1915,367 @@ public:
 	}
 	
 		  
-	template<typename TIN, typename TOUT>
-	void encode(const TIN &in, TOUT &out) const { 
-		if (configuration("encoderFast",true))
+	// optimal picks the optimal parse over the greedy one, as the "encoderOptimal" configuration does.
+	template<typename TIN, typename TOUT, typename std::enable_if<sizeof(typename TIN::value_type)==1,int>::type = 0>
+	void encode(const TIN &in, TOUT &out, bool optimal = false) const { 
+		if (optimal or configuration("encoderOptimal",false))
+			encoderFast.encodeOptimal(in, out);
+		else if (configuration("encoderFast",true))
 			encoderFast(in, out);
-		else
+		else {
+			EncoderSlow encoderSlow(words);
 			encoderSlow(in, out);
+		}
 	}
 
-	template<typename TIN, typename TOUT>
+	// First limit symbols of an 8 bit encoded block (fewer if the block is shorter).
+	template<typename TIN, typename TOUT, typename std::enable_if<sizeof(typename TOUT::value_type)==1,int>::type = 0>
+	void decodePrefix(const TIN &in, TOUT &out, size_t limit) const { 
+		
+		if (not largeAlphabet.empty()) 
+			throw std::runtime_error ("prefix decoding is only supported for 8 bit dictionaries");
+		decoderFast.prefix(in, out, limit);
+	}
+
+	// Raw buffer versions for single 8 bit blocks. encode writes at most n bytes and returns the encoded size, 
+	// n or more if the block does not compress. decode returns the decoded size, and out needs 64 bytes of 
+	// slack past it.
+	size_t encode(const uint8_t *in, size_t n, uint8_t *out, bool optimal = false) const { 
+		
+		if (not largeAlphabet.empty()) 
+			throw std::runtime_error ("raw buffer encoding is only supported for 8 bit dictionaries");
+		
+		Span<const uint8_t> i{in, n};
+		Span<uint8_t> o{out, n};
+		if (optimal or configuration("encoderOptimal",false))
+			encoderFast.encodeOptimal(i, o);
+		else
+			encoderFast(i, o);
+		return o.size();
+	}
+
+	size_t decode(const uint8_t *in, size_t n, uint8_t *out) const { 
+		
+		if (not largeAlphabet.empty()) 
+			throw std::runtime_error ("raw buffer decoding is only supported for 8 bit dictionaries");
+		
+		Span<const uint8_t> i{in, n};
+		Span<uint8_t> o{out, 0};
+		decoderFast(i, o);
+		return o.size();
+	}
+
+	// Bytes past its decoded size that a buffer needs to decode this 8 bit encoded block in place.
+	template<typename TIN>
+	size_t inPlaceMargin(const TIN &in) const { 
+		
+		size_t margin;
+		decoderFast.inPlace(in, margin);
+		return margin;
+	}
+
+	// Decodes the 8 bit encoded block held in the last compressedSize bytes of buffer to the start of buffer, 
+	// so a block needs no more memory than its decoded size plus inPlaceMargin. Returns the decoded size, or 
+	// -1 leaving buffer untouched if capacity is too small, or the stream or buffer end is not 4 byte aligned.
+	ssize_t decodeInPlace(uint8_t *buffer, size_t capacity, size_t compressedSize) const { 
+		
+		if (not largeAlphabet.empty()) 
+			throw std::runtime_error ("in place decoding is only supported for 8 bit dictionaries");
+		if (compressedSize%4 or capacity%4 or compressedSize>capacity)
+			return -1;
+		
+		Span<uint8_t> in{buffer+capacity-compressedSize, compressedSize}, out{buffer, 0};
+		size_t margin, decodedSize = decoderFast.inPlace(in, margin);
+		if (decodedSize + margin > capacity) 
+			return -1;
+		
+		decoderFast(in, out);
+		return out.size();
+	}
+
+	// Statistics of an 8 bit encoded block, read from the compressed stream.
+	template<typename TIN>
+	Statistics scan(const TIN &in, bool withHistogram = false) const { 
+		
+		if (not largeAlphabet.empty()) 
+			throw std::runtime_error ("scan is only supported for 8 bit dictionaries");
+		std::call_once(scannerBuilt, [this]{ scanner.reset(new Scanner(*words)); });
+		return (*scanner)(in, withHistogram);
+	}
+
+	template<typename TIN, typename TOUT, typename std::enable_if<sizeof(typename TOUT::value_type)==1,int>::type = 0>
 	void decode(const TIN &in, TOUT &out) const { 
 		if (configuration("decoderFast",true))
 			decoderFast(in, out); 
-		else
+		else {
+			DecoderSlow decoderSlow(words);
 			decoderSlow(in, out);
+		}
+	}
+
+	// 16 bit values, requires a dictionary built over a LargeAlphabet. If the block can not be compressed, 
+	// out is resized to the size in bytes of the input.
+	template<typename TIN, typename TOUT, typename std::enable_if<sizeof(typename TIN::value_type)==2,int>::type = 0>
+	void encode(const TIN &in, TOUT &out) const { 
+		
+		if (largeAlphabet.empty()) 
+			throw std::runtime_error ("16 bit encoding requires a large alphabet dictionary");
+		
+		std::vector<Symbol> symbols(in.size());
+		std::vector<uint16_t> escapes;
+		for (size_t i=0; i<in.size(); i++) {
+			symbols[i] = largeAlphabet.symbolOf[in[i]];
+			if (symbols[i] == LargeAlphabet::Escape)
+				escapes.push_back(in[i]);
+		}
+		
+		std::vector<uint8_t> stream(2*symbols.size());
+		encode(symbols, stream);
+		
+		size_t header = 4 + ((2*escapes.size()+3) & ~size_t(3));
+		if (header + stream.size() >= 2*in.size()) {
+			out.resize(2*in.size());
+			return;
+		}
+		
+		out.resize(header + stream.size());
+		uint8_t *o = (uint8_t *)&out.front();
+		*(uint32_t *)o = escapes.size();
+		if (not escapes.empty()) memcpy(o+4, escapes.data(), 2*escapes.size());
+		memcpy(o+header, stream.data(), stream.size());
+	}
+
+	template<typename TIN, typename TOUT, typename std::enable_if<sizeof(typename TOUT::value_type)==2,int>::type = 0>
+	void decode(const TIN &in, TOUT &out) const { 
+		
+		if (not decoder16) 
+			throw std::runtime_error ("16 bit decoding requires a large alphabet dictionary");
+		(*decoder16)(in, out);
+	}
+};
+
+
+// Experimental: order-1 context switched dictionaries.
+// Each word is coded with the dictionary of the context of the last symbol of the previous word. Every context
+// has its own dictionary, built on the distribution conditioned to that context. The decoder table stores the
+// next context besides each word, so decoding is still a single table lookup per key.
+class Marlin2018Context {
+	
+	typedef uint8_t Symbol;
+	typedef Marlin2018Simple::Word Word;
+	typedef Marlin2018Simple::Dictionary Dictionary;
+	
+	enum : uint32_t { NONE = uint32_t(-1) };
+
+	const size_t keySize;
+	const size_t maxWordSize;
+	const size_t nContexts;
+	const std::array<uint8_t,256> contextOf;
+
+	// Encoder: one trie per context, stored as a jump table with 256 children per node.
+	std::vector<uint32_t> trieChild;
+	std::vector<uint32_t> trieKey; // Key of the word ending in each node, or NONE if the node is not a word.
+	std::vector<uint32_t> trieRoot;
+	std::vector<uint32_t> emptyKey;
+
+	// Decoder: each entry holds the word, the next context (second to last byte) and the word length (last byte).
+	std::vector<Symbol> decoderTable;
+	
+	size_t entrySize() const { return maxWordSize+2; }
+	
+	template<typename T, size_t N, typename TIN, typename TOUT>
+	void decodeA(const TIN &in, TOUT &out) const  {
+		
+		size_t expected = out.size();
+		uint8_t *o = (uint8_t *)&out.front();
+		const uint32_t *i = (const uint32_t *)in.data();
+		const uint32_t *iend = (const uint32_t *)&*in.end();
+
+		uint64_t mask = (1<<keySize)-1;
+		const std::array<T,N> *DD = (const std::array<T,N> *)decoderTable.data();
+		uint64_t v32 = 0; int32_t c=-keySize;
+		size_t ctx = 0;
+		
+		while (c>=0 or i<iend) {
+			
+			if (c<0) {
+				v32 = (v32<<32) + *i++;
+				c   += 32;
+			}
+			const uint8_t *v = (const uint8_t *)&DD[(ctx<<keySize) + ((v32>>c) & mask)];
+			c -= keySize;
+			for (size_t n=0; n<N; n++)
+				*(((T *)o)+n) = *(((const T *)v)+n);
+			o += v[N*sizeof(T)-1];
+			ctx = v[N*sizeof(T)-2];
+		}
+		out.resize(std::min(expected, size_t(o-(uint8_t *)&out.front())));
+	}
+
+public:
+	
+	// Default context: bit length of the magnitude of the residual, saturated to nContexts-1.
+	static std::array<uint8_t,256> magnitudeContexts(size_t nContexts) {
+		
+		std::array<uint8_t,256> ctx;
+		for (size_t s=0; s<256; s++) {
+			size_t m = std::abs(int(int8_t(s))), bits = 0;
+			while (m) { bits++; m>>=1; }
+			ctx[s] = std::min(bits, nContexts-1);
+		}
+		return ctx;
+	}
+	
+	// A context rules a whole word, not a single symbol, so the symbols up to horizon positions ahead are counted.
+	static std::vector<std::vector<double>> conditionalPdfs(const std::vector<uint8_t> &data, const std::array<uint8_t,256> &contextOf, size_t nContexts, size_t horizon = 4) {
+		
+		std::vector<std::vector<double>> pdfs(nContexts, std::vector<double>(256, 1e-3));
+		for (size_t i=1; i<data.size(); i++)
+			for (size_t h=0; h<horizon and i+h<data.size(); h++)
+				pdfs[contextOf[data[i-1]]][data[i+h]] += 1./(h+1);
+		
+		for (auto &&pdf : pdfs) {
+			double sum = std::accumulate(pdf.begin(), pdf.end(), 0.);
+			for (auto &&p : pdf) p /= sum;
+		}
+		return pdfs;
+	}
+
+	Marlin2018Context(
+		const std::vector<std::vector<double>> &pdfs, 
+		size_t keySize_, 
+		size_t maxWordSize_, 
+		std::array<uint8_t,256> contextOf_ = magnitudeContexts(4)) 
+		: keySize(keySize_), maxWordSize(maxWordSize_), nContexts(pdfs.size()), contextOf(contextOf_) {
+		
+		if (entrySize()!=8 and entrySize()!=16 and entrySize()!=32 and entrySize()!=64)
+			throw std::runtime_error ("unsupported maxWordSize");
+		if (nContexts>256)
+			throw std::runtime_error ("too many contexts");
+		
+		// No overlap: all sections are victim, so every symbol has its own single symbol word.
+		std::vector<std::shared_ptr<Dictionary>> dictionaries;
+		for (auto &&pdf : pdfs)
+			dictionaries.push_back(std::make_shared<Dictionary>(pdf, keySize, 0, maxWordSize));
+
+		trieRoot.resize(nContexts);
+		emptyKey.resize(nContexts, NONE);
+		for (size_t ctx=0; ctx<nContexts; ctx++) {
+			
+			const Dictionary &dict = *dictionaries[ctx];
+			
+			uint32_t root = trieRoot[ctx] = trieKey.size();
+			trieChild.resize(trieChild.size()+256, NONE);
+			trieKey.push_back(NONE);
+			
+			for (size_t k=0; k<dict.size(); k++) {
+				
+				uint32_t node = root;
+				for (auto &&c : dict[k]) {
+					if (trieChild[node*256+c] == NONE) {
+						trieChild[node*256+c] = trieKey.size();
+						trieChild.resize(trieChild.size()+256, NONE);
+						trieKey.push_back(NONE);
+					}
+					node = trieChild[node*256+c];
+				}
+				if (trieKey[node] == NONE) trieKey[node] = k;
+			}
+			emptyKey[ctx] = trieKey[root];
+			if (emptyKey[ctx] == NONE)
+				throw std::runtime_error ("context dictionary without empty word");
+		}
+		
+		decoderTable.resize(nContexts*(1<<keySize)*entrySize());
+		for (size_t ctx=0; ctx<nContexts; ctx++) {
+			for (size_t k=0; k<(1U<<keySize); k++) {
+				
+				const Word &w = (*dictionaries[ctx])[k];
+				Symbol *d = &decoderTable[((ctx<<keySize)+k)*entrySize()];
+				for (auto &&c : w) *d++ = c;
+				decoderTable[((ctx<<keySize)+k+1)*entrySize()-2] = w.empty() ? ctx : contextOf[w.back()];
+				decoderTable[((ctx<<keySize)+k+1)*entrySize()-1] = w.size();
+			}
+		}
+	}
+	
+	// As in Marlin2018Simple, out keeps at least the size of in if it does not compress, or can not be parsed.
+	template<class TIN, typename TOUT, typename std::enable_if<sizeof(typename TIN::value_type)==1,int>::type = 0>		
+	void encode(const TIN &in, TOUT &out) const {
+		
+		if (out.size() < 2*in.size()) out.resize(in.size());
+
+		uint32_t *o = (uint32_t *)&*out.begin();
+		uint32_t *oend = o + out.size()/4;
+		const uint8_t *i = (const uint8_t *)&in.front();
+		const uint8_t *iend = i + in.size();
+		
+		uint64_t value=0; int32_t bits=0;
+		size_t ctx = 0;
+		while (i<iend) {
+			
+			// Greedy longest match in the dictionary of the current context
+			uint32_t node = trieRoot[ctx], key = NONE;
+			const uint8_t *last = i, *j = i;
+			for (; j<iend and trieChild[node*256+*j] != NONE; j++) {
+				node = trieChild[node*256+*j];
+				if (trieKey[node] != NONE) {
+					key = trieKey[node];
+					last = j+1;
+				}
+			}
+			// No word starts here. Dropping the rest of the input would decode to the wrong data.
+			if (key == NONE and j<iend) 
+				return;
+			
+			// Input ends inside a prefix that is not a word: complete it with any word, the decoder truncates it.
+			if (key == NONE) {
+				uint8_t c = 0;
+				while (trieKey[node] == NONE) {
+					for (c=0; trieChild[node*256+c] == NONE; c++);
+					node = trieChild[node*256+c];
+				}
+				key = trieKey[node];
+				last = iend;
+				ctx = contextOf[c];
+			} else {
+				ctx = contextOf[last[-1]];
+			}
+			i = last;
+			
+			value <<= keySize;
+			bits += keySize;
+			value += key;
+			if (bits>=32) {
+				if (o==oend) return;
+				bits -= 32;
+				*o++ = value>>bits;
+			}
+		}
+		
+		while (bits>0) {
+			while (bits<32) {
+				value <<= keySize;
+				bits += keySize;
+				value += emptyKey[ctx];
+			}
+			if (o==oend) return;
+			bits -= 32;
+			*o++ = value>>bits;
+		}
+		out.resize((uint8_t *)o-(uint8_t *)&out.front());
+	}
+
+	// out must be sized to the uncompressed length, plus slack for the entry sized writes.
+	template<typename TIN, typename TOUT>
+	void decode(const TIN &in, TOUT &out) const {
+		
+		switch (entrySize()) {
+			case   8: return decodeA<uint64_t, 1>(in, out);
+			case  16: return decodeA<uint64_t, 2>(in, out);
+			case  32: return decodeA<uint64_t, 4>(in, out);
+			case  64: return decodeA<uint64_t, 8>(in, out);
+			default: throw std::runtime_error ("unsupported maxWordSize");
+		}
 	}
 };
@@ -3,11 +3,13 @@
 #include <array>
 #include <vector>
 #include <functional>
+#include <algorithm>
 
 #include <opencv/cv.h>
 
 //static const int BlockSizeBytes = 4096; // In bytes
-static const int BlockSizeBytes = 4096; // In bytes
+static const int BlockSizeBytes = 4096; // In bytes, default block size (see CODEC8::setBlockSizeBytes)
+static const size_t MinBlockSizeBytes = 1<<10, MaxBlockSizeBytes = 1<<20;
 static const int BlockCapacityBytes = 4*BlockSizeBytes; // We overprovision each block because some algorithms have compression rates < 1
 
 #ifdef __APPLE__
@@ -26,11 +28,17 @@ template<typename T>
 class AlignedArray {
 
 	void copy(const AlignedArray&  p) noexcept {
-		AACapacityBytes = p.AACapacityBytes;
+		if (not owned) makeOwning();
+		sz = 0;
+		reserve(p.sz);
 		sz = p.sz;
+		if (not p.owned) {
+			memcpy(ptr, p.ptr, sz*sizeof(T));
+			return;
+		}
 		__m128i *ptr1 = (__m128i *)ptr;
 		const __m128i *ptr2 = (const __m128i *)p.ptr;
-		for (size_t i=0; i<p.sz; i+=64) {
+		for (size_t i=0; i<p.sz*sizeof(T); i+=64) {
 			*ptr1++ = *ptr2++;
 			*ptr1++ = *ptr2++;
 			*ptr1++ = *ptr2++;
@@ -41,6 +49,9 @@ class AlignedArray {
 	uint8_t *ptr = (uint8_t *)aligned_alloc(64,4*4096);
 	size_t AACapacityBytes = 4096;
 	size_t sz = 0;
+	bool owned = true;
+
+	AlignedArray            (const T *d, size_t n, bool) noexcept : ptr(const_cast<uint8_t *>(reinterpret_cast<const uint8_t *>(d))), AACapacityBytes(n*sizeof(T)), sz(n), owned(false) {}
 
 public:
 
@@ -52,13 +63,27 @@ public:
 		AACapacityBytes(AACapacityBytes), 
 		sz(0) {}
     AlignedArray			(const AlignedArray&  p) noexcept { copy(p); }
-    AlignedArray            (      AlignedArray&& p) noexcept : ptr(p.ptr), AACapacityBytes(p.AACapacityBytes), sz(p.sz) { p.ptr=nullptr; p.sz = 0; }
+    AlignedArray            (      AlignedArray&& p) noexcept : ptr(p.ptr), AACapacityBytes(p.AACapacityBytes), sz(p.sz), owned(p.owned) { p.ptr=nullptr; p.sz = 0; }
     AlignedArray& operator= (const AlignedArray&  p) noexcept { copy(p); return *this; }
-    AlignedArray& operator= (      AlignedArray&& p) noexcept { std::swap(ptr,p.ptr); std::swap(sz, p.sz); return *this; }
+    AlignedArray& operator= (      AlignedArray&& p) noexcept { std::swap(ptr,p.ptr); std::swap(sz, p.sz); std::swap(AACapacityBytes, p.AACapacityBytes); std::swap(owned, p.owned); return *this; }
+
+    AlignedArray (const T *d, size_t n) noexcept { reserve(n); sz = n; memcpy(ptr,d,sz*sizeof(T)); }
+
+    ~AlignedArray() { if (ptr!=nullptr and owned) free(ptr); }
 
-    AlignedArray (const T *d, size_t n) noexcept : sz(n) { memcpy(ptr,d,sz*sizeof(T)); }
+	// Non owning, read only view of n items at d (e.g., in an mmaped file), which must outlive it and need not be 
+	// aligned. Copying a view gives an owning array; writing through one writes to the caller's memory.
+	static AlignedArray view(const T *d, size_t n) noexcept { return AlignedArray(d, n, true); }
+	constexpr bool isView() { return not owned; }
 
-    ~AlignedArray() { if (ptr!=nullptr) free(ptr); }
+	// Drops a view for a fresh owned buffer, without copying its contents.
+	void makeOwning() noexcept {
+		if (owned) return;
+		ptr = (uint8_t *)aligned_alloc(64,4*4096);
+		AACapacityBytes = 4096;
+		sz = 0;
+		owned = true;
+	}
 
     constexpr size_t capacity() { return AACapacityBytes/sizeof(T); };
     constexpr T & front() { return *begin(); }
@@ -66,6 +91,18 @@ public:
     constexpr T * data() const { return (T *)ptr; };
     constexpr T * end() { return ((T *)ptr)+sz; };
 
+	// Makes room for n items, keeping the current ones. As by default, the buffer is overprovisioned 4x.
+	void reserve(size_t n) noexcept {
+		if (owned and n*sizeof(T) <= AACapacityBytes) return;
+		size_t capacityBytes = std::max((n*sizeof(T)+63)/64*64, size_t(4096));
+		uint8_t *p = (uint8_t *)aligned_alloc(64,4*capacityBytes);
+		if (sz) memcpy(p, ptr, sz*sizeof(T));
+		if (owned and ptr!=nullptr) free(ptr);
+		ptr = p;
+		AACapacityBytes = capacityBytes;
+		owned = true;
+	}
+
 	void push_back(const T &t) { *(end()) = t; sz++; }
 
     constexpr size_t size() { return sz; };
@@ -106,15 +143,47 @@ struct StrippedData : public std::vector<AlignedArray<T>> {
 };
 
 
+// Undoes the tile prediction of UncompressedData(cv::Mat_<T>) one row at a time, writing straight into the image.
+// Rows of blockWidth residuals must be fed in order; shift is added to every residual first. Tiles are 64 bytes 
+// wide and as high as the block size allows.
+template<typename T>
+struct TileSink {
+
+	static const int blockWidth = 64/sizeof(T);
+	static int blockHeight(size_t blockSizeBytes) { return blockSizeBytes/64; }
+
+	cv::Mat_<T> &img;
+	const int i, j;
+	const T shift;
+	int row = 0;
+
+	TileSink(cv::Mat_<T> &img_, int i_, int j_, T shift_ = 0) : img(img_), i(i_), j(j_), shift(shift_) {}
+
+	void operator()(const T *t) {
+
+		T *s0 = &img(i+row,j);
+		if (row++ == 0) {
+			T *s1 = s0;
+			*s0++ = *t++ + shift;
+			for (int jj=1; jj<blockWidth; jj++)
+				*s0++ = *t++ + shift + *s1++;
+		} else {
+			const T *s1 = &img(i+row-2,j);
+			for (int jj=0; jj<blockWidth; jj++)
+				*s0++ = *t++ + shift + *s1++;
+		}
+	}
+};
+
 template<typename T>
 struct UncompressedData : public StrippedData<T> {
 
 	UncompressedData() noexcept {};
 
 	// From and to vector
-	explicit UncompressedData(const std::vector<T> &data) noexcept {
+	explicit UncompressedData(const std::vector<T> &data, size_t blockSizeBytes = BlockSizeBytes) noexcept {
 
-		size_t nItemsPerStrip = BlockSizeBytes/sizeof(T);
+		size_t nItemsPerStrip = blockSizeBytes/sizeof(T);
 		for (size_t i=0; i<data.size(); i+=nItemsPerStrip)
 			this->emplace_back(&data[i], std::min(data.size()-i, nItemsPerStrip));
 	}
@@ -132,9 +201,9 @@ struct UncompressedData : public StrippedData<T> {
 
 
 	// From and to string
-	explicit UncompressedData(const std::string &str) noexcept {
+	explicit UncompressedData(const std::string &str, size_t blockSizeBytes = BlockSizeBytes) noexcept {
 
-		size_t nItemsPerStrip = BlockSizeBytes/sizeof(T);
+		size_t nItemsPerStrip = blockSizeBytes/sizeof(T);
 		const T *data = (const T *)str.data();
 		size_t nItems = str.size()/sizeof(T);
 		for (size_t i=0; i<nItems; i+=nItemsPerStrip)
@@ -154,15 +223,16 @@ struct UncompressedData : public StrippedData<T> {
 
 
 	// From and to images
-	explicit UncompressedData(const cv::Mat_<T> img) {
+	explicit UncompressedData(const cv::Mat_<T> img, size_t blockSizeBytes = BlockSizeBytes) {
 
-		static const int blockWidth = 64/sizeof(T);
-		static const int blockHeight = (BlockSizeBytes/64)/sizeof(T);
+		const int blockWidth = TileSink<T>::blockWidth;
+		const int blockHeight = TileSink<T>::blockHeight(blockSizeBytes);
 
 		for (int i=0; i<img.rows-blockHeight+1; i+=blockHeight) {
 			for (int j=0; j<img.cols-blockWidth+1; j+=blockWidth) {
 
 				this->emplace_back();
+				this->back().reserve(blockWidth*blockHeight);
 				this->back().resize(blockWidth*blockHeight);
 
 				const T *s0 = &img(i,j);
@@ -186,12 +256,12 @@ struct UncompressedData : public StrippedData<T> {
 		}
 	}
 
-	cv::Mat_<T> img(int rows, int cols) const {
+	cv::Mat_<T> img(int rows, int cols, size_t blockSizeBytes = BlockSizeBytes) const {
 
 		cv::Mat_<T> img(rows, cols);
 
-		static const int blockWidth = 64/sizeof(T);
-		static const int blockHeight = (BlockSizeBytes/64)/sizeof(T);
+		const int blockWidth = TileSink<T>::blockWidth;
+		const int blockHeight = TileSink<T>::blockHeight(blockSizeBytes);
 
 		auto it = this->begin();
 		for (int i=0; i<img.rows-blockHeight+1; i+=blockHeight) {
@@ -199,23 +269,9 @@ struct UncompressedData : public StrippedData<T> {
 
 				auto &block = *it++;
 
-				T *s0 = &img(i,j);
-				T *s1 = &img(i,j);
-				const T *t = block.begin();
-
-				*s0++ = *t++;
-				for (int jj=1; jj<blockWidth; jj++)
-					*s0++ = *t++ + *s1++;
-
-
-				for (int ii=1; ii<blockHeight; ii++) {
-
-					s0 = &img(i+ii,j);
-					s1 = &img(i+ii-1,j);
-
-					for (int jj=0; jj<blockWidth; jj++)
-						*s0++ = *t++ + *s1++;
-				}
+				TileSink<T> tile(img, i, j);
+				for (int ii=0; ii<blockHeight; ii++)
+					tile(block.begin() + ii*blockWidth);
 			}
 		}
 
@@ -224,12 +280,28 @@ struct UncompressedData : public StrippedData<T> {
 
 
 	// From and to random data
-	explicit UncompressedData(const T *p, size_t sz) noexcept {
+	explicit UncompressedData(const T *p, size_t sz, size_t blockSizeBytes = BlockSizeBytes) noexcept {
 
-		size_t nItemsPerStrip = BlockSizeBytes/sizeof(T);
+		size_t nItemsPerStrip = blockSizeBytes/sizeof(T);
 		for (size_t i=0; i<sz; i+=nItemsPerStrip)
 			this->emplace_back(&p[i], std::min(sz-i, nItemsPerStrip));
 	}
+
+	// As above but without copying: blocks are views of p, which must outlive them. The last block is still
+	// copied, so that codecs reading a few bytes past a block never read past the end of p.
+	static UncompressedData view(const T *p, size_t sz, size_t blockSizeBytes = BlockSizeBytes) noexcept {
+
+		UncompressedData data;
+		size_t nItemsPerStrip = blockSizeBytes/sizeof(T);
+		data.reserve((sz+nItemsPerStrip-1)/nItemsPerStrip);
+		for (size_t i=0; i<sz; i+=nItemsPerStrip) {
+			if (i+nItemsPerStrip < sz)
+				data.push_back(AlignedArray<T>::view(&p[i], nItemsPerStrip));
+			else
+				data.emplace_back(&p[i], sz-i);
+		}
+		return data;
+	}
 	
 	void copyTo(T *p) {
 		
@@ -264,8 +336,13 @@ struct CompressedData : public StrippedData<T> {
 		oss.write((char *)&nBlocks, sizeof(nBlocks));
 		for (auto &i : *this) {
 
-			uint16_t bs = i.size();
+			// Sizes that do not fit in 16 bits are escaped, and follow in 32 bits.
+			uint16_t bs = std::min(i.size(), size_t(0xFFFF));
 			oss.write((char *)&bs, sizeof(bs));
+			if (bs == 0xFFFF) {
+				uint32_t bs32 = i.size();
+				oss.write((char *)&bs32, sizeof(bs32));
+			}
 			oss.write((char *)i.begin(), i.size()*sizeof(T));
 		}
 		return oss.str();
@@ -281,7 +358,14 @@ struct CompressedData : public StrippedData<T> {
 
 			uint16_t bs;
 			iss.read((char *)&bs, sizeof(bs));
-			i.resize(bs);
+			size_t n = bs;
+			if (bs == 0xFFFF) {
+				uint32_t bs32;
+				iss.read((char *)&bs32, sizeof(bs32));
+				n = bs32;
+			}
+			i.reserve(n);
+			i.resize(n);
 			iss.read((char *)i.begin(), i.size()*sizeof(T));
 		}
 
@@ -293,3 +377,6 @@ struct CompressedData : public StrippedData<T> {
 typedef AlignedArray<uint8_t> AlignedArray8;
 typedef UncompressedData<uint8_t> UncompressedData8;
 typedef CompressedData<uint8_t> CompressedData8;
+
+typedef AlignedArray<uint16_t> AlignedArray16;
+typedef UncompressedData<uint16_t> UncompressedData16;
@@ -6,10 +6,155 @@
 
 // Base CODEC8 class always gets a buffer of 8 bits, compresses into a StrippedData structure, and vice-versa.
 class CODEC8 {
+
+	size_t blockBytes = BlockSizeBytes;
+
 public:
 	virtual std::string name() const { return "RAW"; };
+
+	// Size of the blocks of UncompressedData8 given to this codec (e.g., UncompressedData8(data, blockSizeBytes())),
+	// and of the blocks it decodes to. Larger blocks amortize headers, smaller ones are faster to access at random.
+	// It must be a power of two between MinBlockSizeBytes and MaxBlockSizeBytes.
+	virtual size_t blockSizeBytes() const { return blockBytes; }
+	virtual void setBlockSizeBytes(size_t n) {
+		
+		if (n<MinBlockSizeBytes or n>MaxBlockSizeBytes or (n&(n-1)))
+			throw std::runtime_error("unsupported block size");
+		blockBytes = n;
+	}
+
 	virtual size_t   compress(const UncompressedData8 &in, CompressedData8 &out) const { out.clear(); for (auto &i : in) out.push_back(i); return out.nBytes(); };
 	virtual size_t uncompress(const CompressedData8 &in, UncompressedData8 &out) const { out.clear(); for (auto &i : in) out.push_back(i); return out.nBytes(); };
+
+	// Inverse of compressing UncompressedData8(img). Codecs that decode block by block can undo the tile 
+	// prediction on the fly instead of going through UncompressedData8::img.
+	virtual cv::Mat_<uint8_t> uncompressImage(const CompressedData8 &in, int rows, int cols) const {
+
+		UncompressedData8 out;
+		out.resize(in.size());
+		for (auto &o : out) { o.reserve(blockSizeBytes()); o.resize(blockSizeBytes()); }
+		uncompress(in, out);
+		return out.img(rows, cols, blockSizeBytes());
+	}
+
+	// In place decompression of block i of nBlocks, for decoders short on memory: buffer holds the compressed 
+	// block in its last compressedSize bytes and gets the decoded bytes (blockSizeBytes(), or less for the last 
+	// block) at its start. header is the last array of the CompressedData8, which has nBlocks+1 arrays. A 
+	// capacity of blockSizeBytes()+InPlaceMarginBytes is enough for codecs that guarantee it. Returns false, 
+	// with buffer untouched, if the codec can not decode the block in this buffer.
+	static const size_t InPlaceMarginBytes = 64;
+	virtual bool uncompressInPlace(const AlignedArray8 &header __attribute__((unused)), size_t nBlocks __attribute__((unused)), size_t i __attribute__((unused)), uint8_t *buffer __attribute__((unused)), size_t capacity __attribute__((unused)), size_t compressedSize __attribute__((unused))) const { return false; }
+
+	// Single block API for small messages, without StrippedData, and without allocations in codecs that work 
+	// at packet level. Blocks of up to BlockSizeBytes, whatever blockSizeBytes() is, are framed by a 4 byte 
+	// header: codec byte (255 for raw), shift and size. compressBlock needs n+4 bytes in out and returns the 
+	// framed size; entropy is the codec byte to use (e.g., a dictionary), in [1,254], or, if negative, the codec 
+	// picks it. uncompressBlock returns the decoded size, and needs 64 bytes of slack past it in out; it throws 
+	// "corrupted block" if the frame does not fit in the n bytes of in.
+	virtual size_t   compressBlock(const uint8_t *in, size_t n, uint8_t *out, int entropy __attribute__((unused)) = -1) const { return storeBlock(in, n, out); }
+	virtual size_t uncompressBlock(const uint8_t *in, size_t n, uint8_t *out) const { 
+		
+		size_t sz = frameSize(in, n);
+		if (in[0]!=255) throw std::runtime_error("block not compressed by " + name());
+		memcpy(out, in+4, sz);
+		return sz;
+	}
+
+	// Batches of single blocks behind one virtual call; the blocks are still coded one by one. out[i].size is the 
+	// capacity of out[i].data on entry, at least what compressBlock or uncompressBlock need (or the batch throws 
+	// before writing anything), and the size written on return.
+	struct BlockView   { const uint8_t *data; size_t size; };
+	struct BlockBuffer {       uint8_t *data; size_t size; };
+	virtual void   compressBlocks(const BlockView *in, BlockBuffer *out, size_t count, int entropy = -1) const {
+		checkCompressBlocks(in, out, count);
+		for (size_t i=0; i<count; i++) out[i].size =   compressBlock(in[i].data, in[i].size, out[i].data, entropy);
+	}
+	virtual void uncompressBlocks(const BlockView *in, BlockBuffer *out, size_t count) const {
+		checkUncompressBlocks(in, out, count);
+		for (size_t i=0; i<count; i++) out[i].size = uncompressBlock(in[i].data, in[i].size, out[i].data);
+	}
+
+protected:
+	static size_t blockSize(const uint8_t *in) { return in[2] + (size_t(in[3])<<8); }
+
+	// Decoded size of the single block in the n bytes of in, once its frame is known to fit in them.
+	static size_t frameSize(const uint8_t *in, size_t n) {
+
+		if (n<4) throw std::runtime_error("corrupted block");
+		size_t sz = blockSize(in);
+		if (sz>size_t(BlockSizeBytes) or (in[0]==255 ? sz>n-4 : n<5)) 
+			throw std::runtime_error("corrupted block");
+		return sz;
+	}
+
+	static void checkCompressBlocks(const BlockView *in, const BlockBuffer *out, size_t count) {
+		for (size_t i=0; i<count; i++)
+			if (out[i].size < in[i].size+4) throw std::runtime_error("block buffer too small");
+	}
+
+	static void checkUncompressBlocks(const BlockView *in, const BlockBuffer *out, size_t count) {
+		for (size_t i=0; i<count; i++)
+			if (out[i].size < frameSize(in[i].data, in[i].size)+64) throw std::runtime_error("block buffer too small");
+	}
+
+	// Headers of codecs that frame StrippedData end with the size of the last block, which may be shorter 
+	// than blockSizeBytes().
+	static const size_t LastBlockSizeBytes = 4;
+
+	static void appendLastBlockSize(AlignedArray8 &header, const UncompressedData8 &in) {
+
+		uint32_t sz = in.empty() ? 0 : in.back().size();
+		size_t pos = header.size();
+		header.reserve(pos + LastBlockSizeBytes);
+		header.resize(pos + LastBlockSizeBytes);
+		memcpy(header.begin() + pos, &sz, LastBlockSizeBytes);
+	}
+
+	// Sizes the blocks to decode, whose capacity must be at least blockSizeBytes().
+	void sizeBlocks(const AlignedArray8 &header, UncompressedData8 &out) const {
+
+		if (header.size() < LastBlockSizeBytes) throw std::runtime_error("corrupted header");
+		for (auto &o : out) o.resize(blockSizeBytes());
+		
+		uint32_t sz;
+		memcpy(&sz, header.data() + header.size() - LastBlockSizeBytes, LastBlockSizeBytes);
+		if (sz > blockSizeBytes()) throw std::runtime_error("corrupted header");
+		if (not out.empty()) out.back().resize(sz);
+	}
+
+	static size_t frameBlock(uint8_t *out, size_t n, uint8_t head, uint8_t shift, size_t payload) {
+
+		if (n>size_t(BlockSizeBytes)) throw std::runtime_error("single blocks are limited to BlockSizeBytes");
+		out[0] = head; out[1] = shift; out[2] = n; out[3] = n>>8;
+		return 4 + payload;
+	}
+
+	static size_t storeBlock(const uint8_t *in, size_t n, uint8_t *out) { 
+
+		memcpy(out+4, in, n);
+		return frameBlock(out, n, 255, 0, n);
+	}
+};
+
+// Base CODEC16 class gets a buffer of 16 bit values. The compressed blocks are byte streams, as in CODEC8.
+class CODEC16 {
+
+	size_t blockBytes = BlockSizeBytes;
+
+public:
+	virtual std::string name() const { return "RAW16"; };
+
+	// As in CODEC8, in bytes.
+	virtual size_t blockSizeBytes() const { return blockBytes; }
+	virtual void setBlockSizeBytes(size_t n) {
+		
+		if (n<MinBlockSizeBytes or n>MaxBlockSizeBytes or (n&(n-1)))
+			throw std::runtime_error("unsupported block size");
+		blockBytes = n;
+	}
+
+	virtual size_t   compress(const UncompressedData16 &in, CompressedData8 &out) const { out.clear(); for (auto &i : in) out.emplace_back((const uint8_t *)i.data(), i.size()*sizeof(uint16_t)); return out.nBytes(); };
+	virtual size_t uncompress(const CompressedData8 &in, UncompressedData16 &out) const { out.clear(); for (auto &i : in) out.emplace_back((const uint16_t *)i.data(), i.size()/sizeof(uint16_t)); return out.nBytes(); };
 };
 
 
@@ -19,8 +164,16 @@ public:
 class CODEC8withPimpl : public CODEC8 {
 public:
 	virtual std::string name() const { return pImpl->name(); }		
-	virtual size_t   compress(const UncompressedData8 &in, CompressedData8 &out) const { out.resize(in.size()); return pImpl->  compress(in, out); }
-	virtual size_t uncompress(const CompressedData8 &in, UncompressedData8 &out) const { out.resize(in.size()); for (auto &o : out) o.resize(BlockSizeBytes); return pImpl->uncompress(in, out); }
+	virtual size_t blockSizeBytes() const { return pImpl->blockSizeBytes(); }
+	virtual void setBlockSizeBytes(size_t n) { pImpl->setBlockSizeBytes(n); }
+	virtual size_t   compress(const UncompressedData8 &in, CompressedData8 &out) const { out.resize(in.size()); for (size_t i=0; i<in.size(); i++) { out[i].makeOwning(); out[i].reserve(in[i].size()); } return pImpl->  compress(in, out); }
+	virtual size_t uncompress(const CompressedData8 &in, UncompressedData8 &out) const { out.resize(in.size()); for (auto &o : out) { o.makeOwning(); o.reserve(blockSizeBytes()); o.resize(blockSizeBytes()); } return pImpl->uncompress(in, out); }
+	virtual cv::Mat_<uint8_t> uncompressImage(const CompressedData8 &in, int rows, int cols) const { return pImpl->uncompressImage(in, rows, cols); }
+	virtual bool uncompressInPlace(const AlignedArray8 &header, size_t nBlocks, size_t i, uint8_t *buffer, size_t capacity, size_t compressedSize) const { return pImpl->uncompressInPlace(header, nBlocks, i, buffer, capacity, compressedSize); }
+	virtual size_t   compressBlock(const uint8_t *in, size_t n, uint8_t *out, int entropy = -1) const { return pImpl->  compressBlock(in, n, out, entropy); }
+	virtual size_t uncompressBlock(const uint8_t *in, size_t n, uint8_t *out) const { return pImpl->uncompressBlock(in, n, out); }
+	virtual void   compressBlocks(const BlockView *in, BlockBuffer *out, size_t count, int entropy = -1) const { pImpl->  compressBlocks(in, out, count, entropy); }
+	virtual void uncompressBlocks(const BlockView *in, BlockBuffer *out, size_t count) const { pImpl->uncompressBlocks(in, out, count); }
 protected:
 
 	CODEC8withPimpl(CODEC8 *pImpl_) : pImpl(pImpl_) {}
@@ -31,12 +184,32 @@ private:
     CODEC8withPimpl& operator=( const CODEC8withPimpl& ) = delete; // non copyable
 };
 
+// CODEC16withPimpl is the interface of the private implementation class for 16 bit codecs
+class CODEC16withPimpl : public CODEC16 {
+public:
+	virtual std::string name() const { return pImpl->name(); }		
+	virtual size_t blockSizeBytes() const { return pImpl->blockSizeBytes(); }
+	virtual void setBlockSizeBytes(size_t n) { pImpl->setBlockSizeBytes(n); }
+	virtual size_t   compress(const UncompressedData16 &in, CompressedData8 &out) const { out.resize(in.size()); for (size_t i=0; i<in.size(); i++) { out[i].makeOwning(); out[i].reserve(in[i].size()*sizeof(uint16_t)); } return pImpl->  compress(in, out); }
+	virtual size_t uncompress(const CompressedData8 &in, UncompressedData16 &out) const { out.resize(in.size()); for (auto &o : out) { o.makeOwning(); o.reserve(blockSizeBytes()/sizeof(uint16_t)); o.resize(blockSizeBytes()/sizeof(uint16_t)); } return pImpl->uncompress(in, out); }
+protected:
+
+	CODEC16withPimpl(CODEC16 *pImpl_) : pImpl(pImpl_) {}
+    std::unique_ptr<CODEC16> pImpl;
+private:
+	CODEC16withPimpl();
+    CODEC16withPimpl( const CODEC16withPimpl& other ) = delete; // non construction-copyable
+    CODEC16withPimpl& operator=( const CODEC16withPimpl& ) = delete; // non copyable
+};
+
 // CODEC8AA is a helper class for simple codecs that implement the alignedarray <-> alignedarray operation
 class CODEC8AA : public CODEC8 {
 	virtual void   compress(const AlignedArray8 &in, AlignedArray8 &out) const { out=in; }
 	virtual void uncompress(const AlignedArray8 &in, AlignedArray8 &out) const { out=in; }	
 public:
 	virtual std::string name() const { return "CODEC8AA"; };
+
+	// The blocks are followed by a header that only holds the size of the last block.
 	virtual size_t   compress(const UncompressedData8 &in, CompressedData8 &out) const {
 		
 		size_t ret = 0;
@@ -48,14 +221,18 @@ public:
 			ret += out[i].size();
 		}
 
-		return ret;
+		out.emplace_back();
+		appendLastBlockSize(out.back(), in);
+		return ret + out.back().size();
 	}
 	virtual size_t uncompress(const CompressedData8 &in, UncompressedData8 &out) const {
 
 		size_t ret = 0;
 		assert(in.size()==out.size());
+		out.resize(in.size()-1);
+		sizeBlocks(in.back(), out);
 		
-		for (size_t i=0; i<in.size(); i++) {
+		for (size_t i=0; i<out.size(); i++) {
 
 			uncompress(in[i], out[i]);
 			ret += out.size();
@@ -64,6 +241,30 @@ public:
 		return ret;
 	}
 	
+	virtual size_t   compressBlock(const uint8_t *in, size_t n, uint8_t *out, int entropy __attribute__((unused)) = -1) const {
+
+		AlignedArray8 block(in, n), compressed;
+		compress(block, compressed);
+		if (compressed.size() > n*0.99)
+			return storeBlock(in, n, out);
+
+		memcpy(out+4, compressed.data(), compressed.size());
+		return frameBlock(out, n, 0, 0, compressed.size());
+	}
+
+	virtual size_t uncompressBlock(const uint8_t *in, size_t n, uint8_t *out) const {
+
+		size_t sz = frameSize(in, n);
+		if (in[0]==255) return CODEC8::uncompressBlock(in, n, out);
+
+		// Decodes straight from the caller's buffer. The output is owned, as codecs may assign to it.
+		AlignedArray8 compressed = AlignedArray8::view(in+4, n-4), block;
+		block.reserve(sz);
+		block.resize(sz);
+		uncompress(compressed, block);
+		memcpy(out, block.data(), sz);
+		return sz;
+	}
 };
 
 // CODEC8Z is a helper class for codecs that need on the entropy of the source (e.g., Marlin)
@@ -79,51 +280,119 @@ class CODEC8Z : public CODEC8 {
 		      std::vector<std::reference_wrapper<      AlignedArray8>> &out,
 		      std::vector<std::reference_wrapper<const uint8_t      >> &entropy __attribute__((unused))) const {for (size_t i=0; i<in.size(); i++) out[i].get() = in[i]; }
 
+protected:
+	// Single packet versions of the hooks above, on raw buffers. compressPacket writes at most n bytes and 
+	// returns the compressed size, n or more if the packet did not compress; it may change the entropy byte. 
+	// uncompressPacket decodes outSize bytes, and may write up to 64 bytes past them. By default they go 
+	// through the vector hooks.
+	virtual size_t compressPacket(const uint8_t *in, size_t n, uint8_t *out, uint8_t &entropy) const {
+
+		AlignedArray8 block(in, n), compressed;
+		std::vector<std::reference_wrapper<const AlignedArray8>> rIn(1, std::cref(block));
+		std::vector<std::reference_wrapper<      AlignedArray8>> rOut(1, std::ref(compressed));
+		std::vector<std::reference_wrapper<      uint8_t      >> rEntropy(1, std::ref(entropy));
+		compress(rIn, rOut, rEntropy);
+		if (compressed.size() < n)
+			memcpy(out, compressed.data(), compressed.size());
+		return compressed.size();
+	}
+
+	virtual void uncompressPacket(const uint8_t *in, size_t n, uint8_t *out, size_t outSize, uint8_t entropy) const {
+
+		AlignedArray8 compressed(in, n), block;
+		block.resize(outSize);
+		std::vector<std::reference_wrapper<const AlignedArray8>> rIn(1, std::cref(compressed));
+		std::vector<std::reference_wrapper<      AlignedArray8>> rOut(1, std::ref(block));
+		std::vector<std::reference_wrapper<const uint8_t      >> rEntropy(1, std::cref(entropy));
+		uncompress(rIn, rOut, rEntropy);
+		memcpy(out, block.data(), outSize);
+	}
+
+	// Decodes a packet of n symbols held in the last compressedSize bytes of buffer to its start, see uncompressInPlace.
+	virtual bool uncompressBlockInPlace(uint8_t *buffer __attribute__((unused)), size_t capacity __attribute__((unused)), size_t compressedSize __attribute__((unused)), size_t n __attribute__((unused)), uint8_t entropy __attribute__((unused))) const { return false; }
+
+	// Margin a packet of n symbols needs to be decoded in place, or more than any buffer would have if not supported.
+	virtual size_t inPlaceMargin(const AlignedArray8 &in __attribute__((unused)), size_t n __attribute__((unused)), uint8_t entropy __attribute__((unused))) const { return SIZE_MAX/2; }
+
+	// If enabled, blocks whose histogram peak is not at zero are shifted so that their mode becomes symbol 0.
+	// The shift of each block is stored in the header, after the entropy bytes.
+	bool enableModeShift = false;
+
+	// If enabled, packets that would need more than InPlaceMarginBytes to be decoded in place are stored raw.
+	bool enableInPlace = false;
+
+	// Raw blocks of views are emitted by reference, so incompressible data is not copied.
+	static void storeRaw(const AlignedArray8 &in, AlignedArray8 &out) {
+		if (in.isView()) out = AlignedArray8::view(in.data(), in.size());
+		else out = in;
+	}
+
+	// Header byte of a block: 255 to store it raw, 0 if all values but the first are zero, else its entropy. 
+	// Codecs that do not use the entropy byte may classify blocks more cheaply.
+	virtual uint8_t classify(const uint8_t *in, size_t n, uint8_t &shift) const {
+
+		shift = 0;
+
+		// Skip compression of very small blocks
+		if (n<256) return 255;
+	
+		std::array<double, 256> hist; hist.fill(0.);
+		for (size_t j=0; j<n; j++) hist[in[j]]++;
+		for (auto &h : hist) h /= n;
+		
+		double entropy = Distribution::entropy(hist)/8.;
+
+		uint8_t head = std::max(1,std::min(255,int(entropy*256)));
+		
+		// Case where there is almost no entropy to gain
+		if (entropy>.99) return 255;
+		
+		// Case where all values (except the first) are zero. The first value may contain a DC component.
+		if (entropy<.01) {
+			
+			bool found = false;
+			for (size_t j=1; not found and j<n; j++) 
+				found  = (in[j] != 0);
+			return found ? head : 0;
+		}
+		
+		// The shift is only applied if it clearly reduces the mean absolute residual, so that flat 
+		// histograms with a spurious peak are left untouched.
+		if (enableModeShift) {
+			size_t mode = std::max_element(hist.begin(), hist.end()) - hist.begin();
+			double mad0 = 0, madMode = 0;
+			for (size_t j=0; j<256; j++) {
+				mad0    += hist[j]*std::abs(int8_t(j));
+				madMode += hist[j]*std::abs(int8_t(j-mode));
+			}
+			if (madMode < 0.9*mad0) shift = mode;
+		}
+		return head;
+	}
+
 public:
 	virtual std::string name() const { return "CODEC8Z"; };
 	virtual size_t   compress(const UncompressedData8 &in, CompressedData8 &out) const {
 		
 		out.resize(in.size()+1);
-		out.back().resize(in.size());
+		out.back().reserve(2*in.size() + LastBlockSizeBytes);
+		out.back().resize(enableModeShift ? 2*in.size() : in.size());
 		uint8_t *head = out.back().begin();
+		uint8_t *shift = head + in.size();
 
 		for (size_t i=0; i<in.size(); i++) {
 			
-			// Skip compression of very small blocks
-			if (in[i].size()<256) {
+			uint8_t s;
+			head[i] = classify(in[i].data(), in[i].size(), s);
+			if (enableModeShift) shift[i] = s;
 
-				out[i] = in[i];
-				head[i] = 255;
-				continue;				
-			}
-		
-			std::array<double, 256> hist; hist.fill(0.);
-			for (auto &v : in[i]) hist[v]++;
-			for (auto &h : hist) h /= in[i].size();
-			
-			double entropy = Distribution::entropy(hist)/8.;
-
-			head[i] = std::max(1,std::min(255,int(entropy*256)));
-			
-			// Case where there is almost no entropy to gain
-			if (entropy>.99) {
-				
-				out[i]=in[i];
-				head[i] = 255;
-				continue;				
-			}
-			
-			// Case where all values (except the first) are zero. The first value may contain a DC component.
-			if (entropy<.01) {
+			if (head[i] == 255) {
 				
-				bool found = false;
-				for (size_t j=1; not found and j<in[i].size(); j++) 
-					found  = (in[i][j] != 0);
-				if (found) continue;
+				storeRaw(in[i], out[i]);
+			} else if (head[i] == 0) {
 
 				out[i][0] = in[i][0];
 				out[i].resize(1);
-				head[i] = 0;
 			}
 		}
 
@@ -139,31 +408,47 @@ public:
 		std::vector<std::reference_wrapper<      AlignedArray8>> rOut;
 		std::vector<std::reference_wrapper<      uint8_t      >> zeroCounts;
 		
+		std::vector<AlignedArray8> shifted;
+		shifted.reserve(packets.size());
+		
 		for (size_t i=0; i<packets.size(); i++) {
-			rIn       .emplace_back(std::cref(in  [packets[i].second]));
-			rOut      .emplace_back(std:: ref(out [packets[i].second]));
-			zeroCounts.emplace_back(std:: ref(head[packets[i].second]));
+			size_t idx = packets[i].second;
+			if (enableModeShift and shift[idx]) {
+				shifted.emplace_back(in[idx]);
+				for (auto &v : shifted.back()) v -= shift[idx];
+				rIn   .emplace_back(std::cref(shifted.back()));
+			} else {
+				rIn   .emplace_back(std::cref(in  [idx]));
+			}
+			rOut      .emplace_back(std:: ref(out [idx]));
+			zeroCounts.emplace_back(std:: ref(head[idx]));
 		}
 		
 		compress(rIn, rOut, zeroCounts);
 		
-		for (size_t i=0; i<packets.size(); i++) {
+		for (auto &&packet : packets) {
 
+			size_t i = packet.second;
 			// If we achieve at least 1% compression, we keep the compressed one.
-			if (out[i].size() > in[i].size()*0.99) {
-				out[i] = in[i];
+			if (out[i].size() > in[i].size()*0.99 or (enableInPlace and inPlaceMargin(out[i], in[i].size(), head[i]) > InPlaceMarginBytes)) {
+				storeRaw(in[i], out[i]);
 				head[i] = 255;
+				if (enableModeShift) shift[i] = 0;
 			}
 		}
 		
+		appendLastBlockSize(out.back(), in);
 		return out.nBytes();
 	}
 
 	virtual size_t uncompress(const CompressedData8 &in, UncompressedData8 &out) const {
 
 		out.resize(in.size()-1);
-		assert(in.back().size()==out.size());
-		uint8_t *head = in.back().begin();
+		sizeBlocks(in.back(), out);
+		bool modeShift = (in.back().size()==2*out.size()+LastBlockSizeBytes);
+		assert(in.back().size()==out.size()+LastBlockSizeBytes or modeShift);
+		const uint8_t *head = in.back().data();
+		const uint8_t *shift = head + out.size();
 		
 		std::vector<std::pair<std::pair<int64_t, int64_t>, size_t>> packets;
 		for (size_t i=0; i<out.size(); i++) {
@@ -193,8 +478,214 @@ public:
 		}
 		
 		uncompress(rIn, rOut, zeroCounts);
+		
+		if (modeShift) {
+			for (auto &&packet : packets) {
+				uint8_t s = shift[packet.second];
+				if (s) for (auto &v : out[packet.second]) v += s;
+			}
+		}
 
 		return out.nBytes();				
 	}
+
+	virtual size_t   compressBlock(const uint8_t *in, size_t n, uint8_t *out, int entropy = -1) const {
+		return compressBlockWith(in, n, out, entropy, [this](const uint8_t *i, size_t m, uint8_t *o, uint8_t &e) { return compressPacket(i, m, o, e); });
+	}
+
+	virtual size_t uncompressBlock(const uint8_t *in, size_t n, uint8_t *out) const {
+		return uncompressBlockWith(in, n, out, [this](const uint8_t *i, size_t m, uint8_t *o, size_t sz, uint8_t e) { uncompressPacket(i, m, o, sz, e); });
+	}
+
+protected:
+	// Block framing around a packet kernel, so that subclasses can bind it statically (see CODEC8Zstatic).
+	template<typename CompressPacket>
+	size_t compressBlockWith(const uint8_t *in, size_t n, uint8_t *out, int entropy, CompressPacket &&compressPacket) const {
+
+		if (n>size_t(BlockSizeBytes)) throw std::runtime_error("single blocks are limited to BlockSizeBytes");
+
+		// 0 and 255 are the zero and raw block markers, not codec bytes.
+		if (entropy==0 or entropy>254) throw std::runtime_error("codec byte out of range [1,254]");
+
+		uint8_t shift = 0;
+		uint8_t head = entropy<0 ? classify(in, n, shift) : entropy;
+		if (head == 0) {
+
+			out[4] = in[0];
+			return frameBlock(out, n, 0, 0, 1);
+		}
+		if (head == 255) return storeBlock(in, n, out);
+
+		const uint8_t *packet = in;
+		alignas(64) uint8_t shifted[BlockSizeBytes];
+		if (shift) {
+			for (size_t j=0; j<n; j++) shifted[j] = in[j] - shift;
+			packet = shifted;
+		}
+
+		size_t compressedSize = compressPacket(packet, n, out+4, head);
+		if (compressedSize > n*0.99)
+			return storeBlock(in, n, out);
+		return frameBlock(out, n, head, shift, compressedSize);
+	}
+
+	template<typename UncompressPacket>
+	size_t uncompressBlockWith(const uint8_t *in, size_t n, uint8_t *out, UncompressPacket &&uncompressPacket) const {
+
+		size_t sz = frameSize(in, n);
+		if        (in[0] == 255) {
+			
+			memcpy(out, in+4, sz);
+		} else if (in[0] == 0  ) {
+			
+			memset(out, 0, sz);
+			out[0] = in[4];
+		} else {
+			
+			uncompressPacket(in+4, n-4, out, sz, in[0]);
+			if (in[1]) for (size_t j=0; j<sz; j++) out[j] += in[1];
+		}
+		return sz;
+	}
+
+public:
+	virtual bool uncompressInPlace(const AlignedArray8 &header, size_t nBlocks, size_t i, uint8_t *buffer, size_t capacity, size_t compressedSize) const {
+
+		// As in uncompress, the header tells whether the encoder stored shifts, not enableModeShift.
+		bool modeShift = (header.size()==2*nBlocks+LastBlockSizeBytes);
+		if (header.size()!=nBlocks+LastBlockSizeBytes and not modeShift) return false;
+		const uint8_t *head = header.data();
+		const uint8_t *shift = head + nBlocks;
+		size_t sz = blockSizeBytes();
+		if (i+1==nBlocks) {
+			uint32_t last;
+			memcpy(&last, header.data() + header.size() - LastBlockSizeBytes, LastBlockSizeBytes);
+			sz = last;
+		}
+		if (i>=nBlocks or compressedSize>capacity or capacity<sz)
+			return false;
+		
+		if        (head[i] == 255) {
+			
+			memmove(buffer, buffer+capacity-compressedSize, compressedSize);
+		} else if (head[i] == 0  ) {
+			
+			uint8_t dc = buffer[capacity-compressedSize];
+			memset(buffer, 0, sz);
+			buffer[0] = dc;
+		} else {
+			
+			if (not uncompressBlockInPlace(buffer, capacity, compressedSize, sz, head[i]))
+				return false;
+			if (modeShift and shift[i]) 
+				for (size_t j=0; j<sz; j++) buffer[j] += shift[i];
+		}
+		return true;
+	}
+
+	// Blocks are decoded in image order, each one straight into its tile.
+	virtual cv::Mat_<uint8_t> uncompressImage(const CompressedData8 &in, int rows, int cols) const {
+		return uncompressImageWith(in, rows, cols, [this](const uint8_t *i, size_t m, uint8_t *o, size_t sz, uint8_t e) { uncompressPacket(i, m, o, sz, e); });
+	}
+
+protected:
+	template<typename UncompressPacket>
+	cv::Mat_<uint8_t> uncompressImageWith(const CompressedData8 &in, int rows, int cols, UncompressPacket &&uncompressPacket) const {
+
+		cv::Mat_<uint8_t> img(rows, cols);
+
+		const int blockWidth = TileSink<uint8_t>::blockWidth;
+		const int blockHeight = TileSink<uint8_t>::blockHeight(blockSizeBytes());
+
+		size_t nBlocks = in.size()-1;
+		bool modeShift = (in.back().size()==2*nBlocks+LastBlockSizeBytes);
+		assert(in.back().size()==nBlocks+LastBlockSizeBytes or modeShift);
+		const uint8_t *head = in.back().data();
+		const uint8_t *shift = head + nBlocks;
+
+		std::array<uint8_t, TileSink<uint8_t>::blockWidth> zeros; zeros.fill(0);
+		AlignedArray8 block;
+		block.reserve(blockSizeBytes());
+
+		size_t b = 0;
+		for (int i=0; i<img.rows-blockHeight+1; i+=blockHeight) {
+			for (int j=0; j<img.cols-blockWidth+1; j+=blockWidth, b++) {
+
+				assert(b<nBlocks);
+				TileSink<uint8_t> tile(img, i, j, modeShift ? shift[b] : 0);
+
+				if        (head[b] == 255) {
+
+					for (int ii=0; ii<blockHeight; ii++)
+						tile(in[b].begin() + ii*blockWidth);
+				} else if (head[b] == 0  ) {
+
+					zeros[0] = in[b][0];
+					tile(zeros.data());
+					zeros[0] = 0;
+					for (int ii=1; ii<blockHeight; ii++)
+						tile(zeros.data());
+				} else {
+
+					uncompressPacket(in[b].data(), in[b].size(), block.begin(), blockSizeBytes(), head[b]);
+					for (int ii=0; ii<blockHeight; ii++)
+						tile(block.begin() + ii*blockWidth);
+				}
+			}
+		}
+
+		return img;
+	}
 };
 
+// CODEC8Zstatic binds the packet kernels of Codec statically in the single block, batch and image entry points. 
+// A batch of small blocks then costs the virtual call of the batch, instead of several per block. Codec must define 
+// compressPacket and uncompressPacket. The StrippedData hooks loop over them, Codec may override the hooks.
+template<typename Codec>
+class CODEC8Zstatic : public CODEC8Z {
+
+	const Codec &codec() const { return static_cast<const Codec &>(*this); }
+
+public:
+	virtual void   compress(
+		const std::vector<std::reference_wrapper<const AlignedArray8>> &in,
+		      std::vector<std::reference_wrapper<      AlignedArray8>> &out,
+		      std::vector<std::reference_wrapper<      uint8_t      >> &entropy) const { 
+
+		for (size_t j=0; j<in.size(); j++) {
+			out[j].get().reserve(in[j].get().size());
+			out[j].get().resize(codec().Codec::compressPacket(in[j].get().data(), in[j].get().size(), out[j].get().begin(), entropy[j]));
+		}
+	}
+
+	virtual void uncompress(
+		const std::vector<std::reference_wrapper<const AlignedArray8>> &in,
+		      std::vector<std::reference_wrapper<      AlignedArray8>> &out,
+		      std::vector<std::reference_wrapper<const uint8_t      >> &entropy) const {
+
+		for (size_t j=0; j<out.size(); j++)
+			codec().Codec::uncompressPacket(in[j].get().data(), in[j].get().size(), out[j].get().begin(), out[j].get().size(), entropy[j]);
+	}
+
+	virtual size_t   compressBlock(const uint8_t *in, size_t n, uint8_t *out, int entropy = -1) const {
+		return compressBlockWith(in, n, out, entropy, [this](const uint8_t *i, size_t m, uint8_t *o, uint8_t &e) { return codec().Codec::compressPacket(i, m, o, e); });
+	}
+
+	virtual size_t uncompressBlock(const uint8_t *in, size_t n, uint8_t *out) const {
+		return uncompressBlockWith(in, n, out, [this](const uint8_t *i, size_t m, uint8_t *o, size_t sz, uint8_t e) { codec().Codec::uncompressPacket(i, m, o, sz, e); });
+	}
+
+	virtual void   compressBlocks(const BlockView *in, BlockBuffer *out, size_t count, int entropy = -1) const {
+		checkCompressBlocks(in, out, count);
+		for (size_t i=0; i<count; i++) out[i].size = CODEC8Zstatic::  compressBlock(in[i].data, in[i].size, out[i].data, entropy);
+	}
+
+	virtual void uncompressBlocks(const BlockView *in, BlockBuffer *out, size_t count) const {
+		checkUncompressBlocks(in, out, count);
+		for (size_t i=0; i<count; i++) out[i].size = CODEC8Zstatic::uncompressBlock(in[i].data, in[i].size, out[i].data);
+	}
+
+	virtual cv::Mat_<uint8_t> uncompressImage(const CompressedData8 &in, int rows, int cols) const {
+		return uncompressImageWith(in, rows, cols, [this](const uint8_t *i, size_t m, uint8_t *o, size_t sz, uint8_t e) { codec().Codec::uncompressPacket(i, m, o, sz, e); });
+	}
+};
@@ -5,6 +5,7 @@
 #include <string>
 #include <cmath>
 #include <numeric>
+#include <algorithm>
 
 class Distribution {
 
@@ -154,4 +155,24 @@ public:
 		return getResiduals(std::vector<double>(pdf.begin(), pdf.end()), S);
 	}
 
+	// For alphabets larger than 256 symbols. Samples by bisection on the cdf, as a lookup table would be too large.
+	static inline std::vector<uint16_t> getResiduals16(const std::vector<double> &pdf, size_t S) {
+
+		std::vector<double> cdf(pdf.size());
+		std::partial_sum(pdf.begin(), pdf.end(), cdf.begin());
+
+		std::vector<uint16_t> ret;
+		uint32_t rnd =  135154;
+		for (size_t i=0; i<S; i++) {
+			rnd = 36969 * (rnd & 65535) + (rnd >> 16);
+			uint32_t r = rnd & 0xFFFF;
+			rnd = 36969 * (rnd & 65535) + (rnd >> 16);
+			r = (r<<16) + (rnd & 0xFFFF);
+			size_t v = std::upper_bound(cdf.begin(), cdf.end(), r*cdf.back()/4294967296.) - cdf.begin();
+			ret.push_back(std::min(v, pdf.size()-1));
+		}
+
+		return ret;
+	}
+
 };
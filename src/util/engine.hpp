@@ -0,0 +1,238 @@
+#pragma once
+#include <util/codec.hpp>
+
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <exception>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// CodecEngine runs compression jobs from any number of callers on a shared pool of worker threads.
+// The queue is bounded: post blocks while it is full, tryPost refuses the job. Jobs posted from the engine's
+// own workers are always queued, as a blocked worker could wait on itself. Workers take queued jobs
+// with the same key (usually the codec) in batches, so a codec's tables stay in cache across small jobs.
+// Inputs and outputs of a job must outlive it.
+class CodecEngine {
+public:
+	typedef std::function<void()> Task;
+	typedef std::function<void(size_t, std::exception_ptr)> Completion;
+	typedef std::function<void(std::exception_ptr)> ErrorHandler;
+
+private:
+	struct Job { const void *key; Task task; };
+
+	const size_t queueCapacity, maxBatch;
+
+	std::mutex mtx;
+	typedef std::unique_lock<std::mutex> Lock;
+	std::condition_variable notEmpty, notFull;
+	std::deque<Job> queue;
+	bool stopping = false;
+
+	std::vector<std::thread> workers;
+
+	// Exceptions thrown by tasks given to post or tryPost.
+	ErrorHandler errorHandler;
+	std::exception_ptr error;
+
+	// Engine the calling thread works for, if any.
+	static const CodecEngine *&currentEngine() {
+		static thread_local const CodecEngine *engine = nullptr;
+		return engine;
+	}
+
+	// Pops the front job and up to maxBatch-1 more with its key, looking a few batches deep into the queue.
+	void takeBatch(std::vector<Task> &batch) {
+
+		const void *key = queue.front().key;
+		batch.push_back(std::move(queue.front().task));
+		queue.pop_front();
+
+		size_t depth = std::min(queue.size(), 4*maxBatch);
+		for (size_t i=0; i<depth and batch.size()<maxBatch; ) {
+			if (queue[i].key == key) {
+				batch.push_back(std::move(queue[i].task));
+				queue.erase(queue.begin()+i);
+				depth--;
+			} else {
+				i++;
+			}
+		}
+	}
+
+	void work() {
+
+		currentEngine() = this;
+		std::vector<Task> batch;
+		while (true) {
+			{
+				Lock l(mtx);
+				notEmpty.wait(l, [this]{ return stopping or not queue.empty(); });
+				if (queue.empty()) return;
+				takeBatch(batch);
+			}
+			notFull.notify_all();
+
+			for (auto &&task : batch) {
+				try {
+					task();
+				} catch (...) {
+					fail(std::current_exception());
+				}
+			}
+			batch.clear();
+		}
+	}
+
+	static void pin(std::thread &t __attribute__((unused)), size_t core __attribute__((unused))) {
+#ifdef __linux__
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		size_t nCores = std::thread::hardware_concurrency();
+		if (not nCores) return; // Unknown
+		CPU_SET(core % nCores, &cpus);
+		pthread_setaffinity_np(t.native_handle(), sizeof(cpus), &cpus);
+#endif
+	}
+
+	void fail(std::exception_ptr err) {
+
+		ErrorHandler handler;
+		{
+			Lock l(mtx);
+			if (not errorHandler) {
+				if (not error) error = err;
+				return;
+			}
+			handler = errorHandler;
+		}
+		handler(err);
+	}
+
+	// Wraps a job so that its result or exception reaches done.
+	static Task withCompletion(std::function<size_t()> job, Completion done) {
+		return [job, done]() {
+			size_t ret = 0;
+			std::exception_ptr err;
+			try { ret = job(); } catch (...) { err = std::current_exception(); }
+			if (done) done(ret, err);
+		};
+	}
+
+	static Task withPromise(std::function<size_t()> job, std::shared_ptr<std::promise<size_t>> promise) {
+		return [job, promise]() {
+			try { promise->set_value(job()); } catch (...) { promise->set_exception(std::current_exception()); }
+		};
+	}
+
+public:
+	CodecEngine(size_t nThreads = std::thread::hardware_concurrency(), size_t queueCapacity_ = 1024, bool pinThreads = true, size_t maxBatch_ = 16)
+		: queueCapacity(std::max(size_t(1),queueCapacity_)), maxBatch(std::max(size_t(1),maxBatch_)) {
+
+		for (size_t i=0; i<std::max(size_t(1),nThreads); i++) {
+			workers.emplace_back([this]{ work(); });
+			if (pinThreads) pin(workers.back(), i);
+		}
+	}
+
+	// Jobs already queued are run before the workers exit.
+	~CodecEngine() {
+		{
+			Lock l(mtx);
+			stopping = true;
+		}
+		notEmpty.notify_all();
+		for (auto &&t : workers) t.join();
+	}
+
+	CodecEngine(const CodecEngine &) = delete;
+	CodecEngine &operator=(const CodecEngine &) = delete;
+
+	size_t size() const { return workers.size(); }
+
+	size_t pending() {
+		Lock l(mtx);
+		return queue.size();
+	}
+
+	// Exceptions escaping task go to the error handler, or are kept for rethrowError.
+	void post(const void *key, Task task) {
+		{
+			Lock l(mtx);
+			if (currentEngine() != this)
+				notFull.wait(l, [this]{ return queue.size() < queueCapacity; });
+			queue.push_back(Job{key, std::move(task)});
+		}
+		notEmpty.notify_one();
+	}
+
+	bool tryPost(const void *key, Task task) {
+		{
+			Lock l(mtx);
+			if (queue.size() >= queueCapacity) return false;
+			queue.push_back(Job{key, std::move(task)});
+		}
+		notEmpty.notify_one();
+		return true;
+	}
+
+	// Called on the worker for each exception of a posted task. Without a handler, the first one is kept.
+	void setErrorHandler(ErrorHandler handler) {
+		Lock l(mtx);
+		errorHandler = handler;
+	}
+
+	// Rethrows, once, the first exception kept from a posted task.
+	void rethrowError() {
+		std::exception_ptr err;
+		{
+			Lock l(mtx);
+			std::swap(err, error);
+		}
+		if (err) std::rethrow_exception(err);
+	}
+
+	// CODEC8 jobs, with a completion callback (run on the worker) or a future. Both return the size
+	// returned by the codec.
+	void   compress(const CODEC8 &codec, const UncompressedData8 &in, CompressedData8 &out, Completion done) {
+		post(&codec, withCompletion([&codec, &in, &out]{ return codec.  compress(in, out); }, done));
+	}
+
+	void uncompress(const CODEC8 &codec, const CompressedData8 &in, UncompressedData8 &out, Completion done) {
+		post(&codec, withCompletion([&codec, &in, &out]{ return codec.uncompress(in, out); }, done));
+	}
+
+	std::future<size_t>   compress(const CODEC8 &codec, const UncompressedData8 &in, CompressedData8 &out) {
+		auto promise = std::make_shared<std::promise<size_t>>();
+		post(&codec, withPromise([&codec, &in, &out]{ return codec.  compress(in, out); }, promise));
+		return promise->get_future();
+	}
+
+	std::future<size_t> uncompress(const CODEC8 &codec, const CompressedData8 &in, UncompressedData8 &out) {
+		auto promise = std::make_shared<std::promise<size_t>>();
+		post(&codec, withPromise([&codec, &in, &out]{ return codec.uncompress(in, out); }, promise));
+		return promise->get_future();
+	}
+
+	// Single blocks, see CODEC8::compressBlock.
+	std::future<size_t>   compressBlock(const CODEC8 &codec, const uint8_t *in, size_t n, uint8_t *out, int entropy = -1) {
+		auto promise = std::make_shared<std::promise<size_t>>();
+		post(&codec, withPromise([&codec, in, n, out, entropy]{ return codec.  compressBlock(in, n, out, entropy); }, promise));
+		return promise->get_future();
+	}
+
+	std::future<size_t> uncompressBlock(const CODEC8 &codec, const uint8_t *in, size_t n, uint8_t *out) {
+		auto promise = std::make_shared<std::promise<size_t>>();
+		post(&codec, withPromise([&codec, in, n, out]{ return codec.uncompressBlock(in, n, out); }, promise));
+		return promise->get_future();
+	}
+};